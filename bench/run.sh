@@ -0,0 +1,64 @@
+#!/bin/sh
+# times the programs here under the flags each one compares, using the
+# repl's own --time report. run it from the top of the tree, with the
+# repl to use if it isn't ./repl: sh bench/run.sh [repl]
+# (a program's errors go to stdout with the rest of its output, so run
+# it by hand if a time looks too good to be true)
+
+repl=${1:-./repl}
+dir=$(dirname "$0")
+
+# generated inputs go here
+tmp=${TMPDIR:-/tmp}/lispy-bench.$$
+mkdir -p "$tmp" || exit 1
+trap 'rm -rf "$tmp"' EXIT
+
+# run LABEL ARGS...: the --time lines for each file the repl runs
+run() {
+    label=$1; shift
+    "$repl" --time "$@" 2>&1 >/dev/null | grep -v '^total:' |
+        while read -r line; do printf '%-14s %s\n' "$label" "$line"; done
+}
+
+echo "== engines: the bytecode VM against the tree walker"
+for f in fib len reverse; do
+    run vm "$dir/$f.lspy"
+    run --no-vm --no-vm "$dir/$f.lspy"
+done
+
+echo "== lookups as the global env grows"
+for n in 100 1000 10000; do
+    awk -v n=$n 'BEGIN { for (i = 0; i < n; i++) printf "(def {v%d} %d)\n", i, i }' \
+        > "$tmp/defs$n.lspy"
+    run "$n defs" "$tmp/defs$n.lspy" "$dir/lookup.lspy"
+done
+
+echo "== list sharing: shared storage against a block per list"
+for f in len reverse; do
+    run shared "$dir/$f.lspy"
+    run --flat-lists --flat-lists "$dir/$f.lspy"
+done
+
+echo "== numbers: bignums and doubles"
+run bignum "$dir/fact.lspy"
+run double "$dir/float.lspy"
+
+echo "== reading: the hand-written reader against mpc, on generated data"
+awk 'BEGIN { for (i = 0; i < 100000; i++)
+    printf "{%d \"item %d\" sym%d {%d %d {nested -%d}}} ; row %d\n", i, i, i, i*7, i*13, i, i }' \
+    > "$tmp/data.lspy"
+run reader "$tmp/data.lspy"
+run --mpc-reader --mpc-reader "$tmp/data.lspy"
+
+# reading value.lspy is reading the text form back, and print.lspy's
+# time is writing it (to /dev/null, as run discards output)
+echo "== persisting 1M nodes: serialize/deserialize against print and read"
+awk 'BEGIN { printf "(def {x} {"
+    for (i = 0; i < 200000; i++) printf "{%d \"row %d\" sym%d %d.5}", i, i, i, i
+    print "})" }' > "$tmp/value.lspy"
+echo "(serialize \"$tmp/value.bin\" x)" > "$tmp/serialize.lspy"
+echo "(def {y} (deserialize \"$tmp/value.bin\"))" > "$tmp/deserialize.lspy"
+echo "(print x)" > "$tmp/print.lspy"
+run binary "$tmp/value.lspy" "$tmp/serialize.lspy" "$tmp/deserialize.lspy"
+run text "$tmp/value.lspy" "$tmp/print.lspy"
+echo "text $(wc -c < "$tmp/value.lspy") bytes, binary $(wc -c < "$tmp/value.bin") bytes"
@@ -1,5 +1,18 @@
+/* -std=c99 hides the POSIX calls (mmap, fdopen, clock_gettime...) without this */
+#define _POSIX_C_SOURCE 200112L
+
 #include <stdio.h>
 #include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <limits.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
 #include "mpc/mpc.h"
 
 #include <editline/readline.h>
@@ -27,6 +40,12 @@ struct lval;
 struct lenv;
 typedef struct lval lval;
 typedef struct lenv lenv;
+typedef struct latom latom;
+typedef struct lcode lcode;
+typedef struct lcells lcells;
+typedef struct lbig lbig;
+typedef struct ltask ltask;
+typedef struct lprof lprof;
 
 mpc_parser_t* Number; 
 mpc_parser_t* Symbol; 
@@ -35,47 +54,551 @@ mpc_parser_t* Comment;
 mpc_parser_t* Sexpr;  
 mpc_parser_t* Qexpr;  
 mpc_parser_t* Expr;
+mpc_parser_t* Program;
+
+/*
+ * object pools
+ *
+ * lvals and lenvs are made and thrown away constantly ((+ 1 2) alone is
+ * several of each), so rather than going to malloc every time we carve
+ * them out of big slabs and recycle them through a free list.
+ */
+
+/* objects per slab */
+#define LPOOL_SLAB 1024
+
+typedef struct lpool {
+    char* name;
+    size_t size;
+    /* free objects, linked through the pointer at this offset */
+    size_t link;
+    void* free;
+    /* every slab we've carved, so they can be released at exit */
+    int nslabs;
+    void** slabs;
+
+    /* counters for the allocs builtin */
+    long allocs;
+    long frees;
+    long live;
+    long peak;
+} lpool;
+
+void* lpool_get(lpool* p) {
+    if (!p->free) {
+        /* out of objects, carve a new slab and thread it onto the free list.
+         * all-ones is how the collector tells an unused object, see gc_sweep */
+        char* slab = malloc(p->size * LPOOL_SLAB);
+        memset(slab, 0xff, p->size * LPOOL_SLAB);
+        p->nslabs++;
+        p->slabs = realloc(p->slabs, sizeof(void*) * p->nslabs);
+        p->slabs[p->nslabs-1] = slab;
+
+        for (int i = LPOOL_SLAB - 1; i >= 0; i--) {
+            char* x = slab + i * p->size;
+            *(void**)(x + p->link) = p->free;
+            p->free = x;
+        }
+    }
+
+    char* x = p->free;
+    p->free = *(void**)(x + p->link);
+
+    p->allocs++;
+    p->live++;
+    if (p->live > p->peak) { p->peak = p->live; }
+    return x;
+}
+
+void lpool_put(lpool* p, void* x) {
+    *(void**)((char*)x + p->link) = p->free;
+    p->free = x;
+    p->frees++;
+    p->live--;
+}
+
+void lpool_print(lpool* p) {
+    printf("%-5s %ld allocs, %ld frees, %ld live (%lu bytes at %lu each), %ld peak, %d slabs\n",
+        p->name, p->allocs, p->frees, p->live,
+        (unsigned long)(p->live * p->size), (unsigned long)p->size,
+        p->peak, p->nslabs);
+}
+
+void lpool_cleanup(lpool* p) {
+    for (int i = 0; i < p->nslabs; i++) {
+        free(p->slabs[i]);
+    }
+    free(p->slabs);
+    p->slabs = NULL;
+    p->nslabs = 0;
+    p->free = NULL;
+}
 
 /*
  * lval setup
  */
 
-enum { LVAL_NUM, LVAL_ERR, LVAL_SYM, LVAL_STR, LVAL_FUN, LVAL_SEXPR, LVAL_QEXPR };
+enum { LVAL_NUM, LVAL_ERR, LVAL_SYM, LVAL_STR, LVAL_FUN, LVAL_SEXPR, LVAL_QEXPR,
+       LVAL_DBL, LVAL_BIG, LVAL_VEC, LVAL_FUT };
+
+/* type of an lval sitting unused in the pool */
+#define LVAL_FREE 0xff
 
 typedef lval*(*lbuiltin)(lenv*, lval*);
 
+/* only the fields for v->type are meaningful, so they share storage */
 struct lval {
-    int type;
+    unsigned char type;
+    /* set while the collector is tracing */
+    unsigned char mark;
+
+    /* number of owners; shared values must not be mutated, see lval_own */
+    int refs;
+
+    union {
+        /* Basic types */
+        long num;
+        double dbl;
+        lbig* big;
+        char* err;
+        latom* sym;
+        char* str;
+        ltask* task;
+
+        /* functions */
+        struct {
+            lbuiltin builtin;
+            lenv* env;
+            lval* formals;
+            lval* body;
+        };
+
+        /* packed vector of vlen nums in ivec, or doubles in dvec */
+        struct {
+            int vlen;
+            int vdbl;
+            long* ivec;
+            double* dvec;
+        };
+
+        /* expression. cell points at count items somewhere in cells,
+         * which other lists may be looking into as well */
+        struct {
+            int count;
+            struct lval** cell;
+            /* bytecode for this list as a lambda body, see lcode_for */
+            lcode* code;
+            lcells* cells;
+        };
+    };
+};
 
-    /* Basic types */
-    long num;
-    char* err;
-    char* sym;
-    char* str;
+/*
+ * counters
+ *
+ * how much work the evaluator does, for (stats) and --stats: evaluations,
+ * calls, copies, lookups and the frames they walk, and lvals made and
+ * freed by type. they're only increments, so they're always kept. like
+ * the pools each thread has its own, so the main thread's don't include
+ * what workers did for it.
+ */
 
-    /* functions */
-    lbuiltin builtin;
-    lenv* env;
-    lval* formals;
-    lval* body;
+typedef struct lstats {
+    /* lval_eval and lval_apply */
+    long evals;
+    long builtin_calls;
+    long lambda_calls;
+    /* lval_copy, and what it allocated for the copies */
+    long copies;
+    long copy_bytes;
+    /* lenv_get, and how many envs it looked in */
+    long lookups;
+    long lookup_frames;
+    /* by the type each lval had when made and when freed */
+    long allocs[LVAL_FUT + 1];
+    long frees[LVAL_FUT + 1];
+} lstats;
+
+__thread lstats lcount;
+
+/* set by --stats */
+int lstats_exit = 0;
+
+/* short names for the types, in enum order */
+char* lstats_types[] = { "num", "err", "sym", "str", "fun", "sexpr", "qexpr",
+                        "dbl", "big", "vec", "fut" };
 
-    /* expression */
-    int count;
-    struct lval** cell;
+/*
+ * list storage
+ *
+ * the items of a list live in a block that several lists can share:
+ * (tail l) is the same block seen from one further along, and consing
+ * onto or joining to the end of a list can fill in room the block has
+ * spare past the ends already in use. items in [lo, hi) belong to the
+ * block, and anything else wanting to change them gets its own copy.
+ * --flat-lists turns the sharing off (every list gets its own block)
+ * for comparison.
+ */
+
+struct lcells {
+    int refs;
+    int mark;
+    int lo, hi, cap;
+    lval* items[];
+};
+
+int lcells_shared = 1;
+
+lcells* lcells_new(int cap) {
+    lcells* b = malloc(sizeof(lcells) + sizeof(lval*) * cap);
+    b->refs = 1;
+    b->mark = 0;
+    b->lo = b->hi = 0;
+    b->cap = cap;
+    return b;
+}
+
+void lval_del(lval* v);
+
+void lcells_drop(lcells* b) {
+    if (--b->refs > 0) { return; }
+    for (int i = b->lo; i < b->hi; i++) {
+        lval_del(b->items[i]);
+    }
+    free(b);
+}
+
+/* every thread has pools of its own, see the parallel section */
+__thread lpool lval_pool = { "lval", sizeof(lval), offsetof(lval, num) };
+
+/* numbers in this range are made once, up front, and shared by everyone
+ * who asks for them, so small counters and flags never allocate. the
+ * sharing bumps reference counts, so each thread has its own table */
+#define LVAL_SMALL_MIN -128
+#define LVAL_SMALL_MAX 1023
+__thread lval lval_small[LVAL_SMALL_MAX - LVAL_SMALL_MIN + 1];
+
+void lval_small_init(void) {
+    for (long i = LVAL_SMALL_MIN; i <= LVAL_SMALL_MAX; i++) {
+        lval* v = &lval_small[i - LVAL_SMALL_MIN];
+        v->type = LVAL_NUM;
+        v->mark = 0;
+        /* the table's own reference, never dropped */
+        v->refs = 1;
+        v->num = i;
+    }
+}
+
+/* every constructor comes through here; the caller owns the one reference */
+lval* lval_alloc(int type) {
+    lcount.allocs[type]++;
+    lval* v = lpool_get(&lval_pool);
+    v->type = type;
+    v->mark = 0;
+    v->refs = 1;
+    return v;
+}
+
+lval* lval_ref(lval* v);
+
+/*
+ * numbers
+ *
+ * LVAL_NUM is a plain long. arithmetic that would overflow one carries
+ * on in an LVAL_BIG, an integer of any size, and results that fit in a
+ * long again go back to being one, so an integer is only ever a bignum
+ * when it has to be. LVAL_DBL is a double; bringing one into any
+ * arithmetic makes the result a double too.
+ */
+
+struct lbig {
+    /* 1 or -1 */
+    int sign;
+    /* limbs in use, least significant first; zero has none */
+    int n;
+    uint32_t d[];
 };
 
+lbig* lbig_new(int n) {
+    lbig* b = malloc(sizeof(lbig) + sizeof(uint32_t) * (n ? n : 1));
+    b->sign = 1;
+    b->n = n;
+    memset(b->d, 0, sizeof(uint32_t) * n);
+    return b;
+}
+
+lbig* lbig_copy(lbig* a) {
+    lbig* b = lbig_new(a->n);
+    b->sign = a->sign;
+    memcpy(b->d, a->d, sizeof(uint32_t) * a->n);
+    return b;
+}
+
+/* drop leading zero limbs */
+void lbig_trim(lbig* b) {
+    while (b->n && !b->d[b->n-1]) { b->n--; }
+    if (!b->n) { b->sign = 1; }
+}
+
+lbig* lbig_from_long(long x) {
+    uint64_t m = x < 0 ? -(uint64_t)x : (uint64_t)x;
+    lbig* b = lbig_new(2);
+    b->sign = x < 0 ? -1 : 1;
+    b->d[0] = (uint32_t)m;
+    b->d[1] = (uint32_t)(m >> 32);
+    lbig_trim(b);
+    return b;
+}
+
+/* put b in *x if it fits in a long */
+int lbig_to_long(lbig* b, long* x) {
+    if (b->n > 2) { return 0; }
+    uint64_t m = 0;
+    for (int i = 0; i < b->n; i++) { m |= (uint64_t)b->d[i] << (32 * i); }
+    if (b->sign > 0) {
+        if (m > LONG_MAX) { return 0; }
+        *x = (long)m;
+    } else {
+        if (m > (uint64_t)LONG_MAX + 1) { return 0; }
+        *x = m == (uint64_t)LONG_MAX + 1 ? LONG_MIN : -(long)m;
+    }
+    return 1;
+}
+
+double lbig_to_double(lbig* b) {
+    double x = 0;
+    for (int i = b->n-1; i >= 0; i--) { x = x * 4294967296.0 + b->d[i]; }
+    return b->sign * x;
+}
+
+int lbig_cmpabs(lbig* a, lbig* b) {
+    if (a->n != b->n) { return a->n < b->n ? -1 : 1; }
+    for (int i = a->n-1; i >= 0; i--) {
+        if (a->d[i] != b->d[i]) { return a->d[i] < b->d[i] ? -1 : 1; }
+    }
+    return 0;
+}
+
+int lbig_cmp(lbig* a, lbig* b) {
+    if (a->sign != b->sign) { return a->sign; }
+    return a->sign * lbig_cmpabs(a, b);
+}
+
+/* |a| + |b| */
+lbig* lbig_addabs(lbig* a, lbig* b) {
+    if (a->n < b->n) { lbig* t = a; a = b; b = t; }
+    lbig* r = lbig_new(a->n + 1);
+    uint64_t carry = 0;
+    for (int i = 0; i < a->n; i++) {
+        carry += (uint64_t)a->d[i] + (i < b->n ? b->d[i] : 0);
+        r->d[i] = (uint32_t)carry;
+        carry >>= 32;
+    }
+    r->d[a->n] = (uint32_t)carry;
+    lbig_trim(r);
+    return r;
+}
+
+/* |a| - |b|, where |a| >= |b| */
+lbig* lbig_subabs(lbig* a, lbig* b) {
+    lbig* r = lbig_new(a->n);
+    int64_t borrow = 0;
+    for (int i = 0; i < a->n; i++) {
+        int64_t x = (int64_t)a->d[i] - (i < b->n ? b->d[i] : 0) - borrow;
+        borrow = x < 0;
+        r->d[i] = (uint32_t)(x + (borrow ? 4294967296LL : 0));
+    }
+    lbig_trim(r);
+    return r;
+}
+
+/* a + sign * b */
+lbig* lbig_add(lbig* a, lbig* b, int sign) {
+    int bsign = b->sign * sign;
+    lbig* r;
+    if (a->sign == bsign) {
+        r = lbig_addabs(a, b);
+        r->sign = a->sign;
+    } else if (lbig_cmpabs(a, b) >= 0) {
+        r = lbig_subabs(a, b);
+        r->sign = a->sign;
+    } else {
+        r = lbig_subabs(b, a);
+        r->sign = bsign;
+    }
+    lbig_trim(r);
+    return r;
+}
+
+lbig* lbig_mul(lbig* a, lbig* b) {
+    lbig* r = lbig_new(a->n + b->n);
+    for (int i = 0; i < a->n; i++) {
+        uint64_t carry = 0;
+        for (int j = 0; j < b->n; j++) {
+            carry += (uint64_t)a->d[i] * b->d[j] + r->d[i+j];
+            r->d[i+j] = (uint32_t)carry;
+            carry >>= 32;
+        }
+        r->d[i + b->n] = (uint32_t)carry;
+    }
+    r->sign = a->sign * b->sign;
+    lbig_trim(r);
+    return r;
+}
+
+/* divide a by m in place, returning the remainder */
+uint32_t lbig_divsmall(lbig* a, uint32_t m) {
+    uint64_t rem = 0;
+    for (int i = a->n-1; i >= 0; i--) {
+        rem = (rem << 32) | a->d[i];
+        a->d[i] = (uint32_t)(rem / m);
+        rem %= m;
+    }
+    lbig_trim(a);
+    return (uint32_t)rem;
+}
+
+/* a / b rounded towards zero, like C; b isn't zero */
+lbig* lbig_div(lbig* a, lbig* b) {
+    lbig* q;
+    if (b->n == 1) {
+        q = lbig_copy(a);
+        lbig_divsmall(q, b->d[0]);
+    } else {
+        /* shift a in a bit at a time, taking b off whenever we can */
+        q = lbig_new(a->n);
+        lbig* r = lbig_new(b->n + 1);
+        r->n = 0;
+        for (int i = a->n * 32 - 1; i >= 0; i--) {
+            uint32_t bit = (a->d[i / 32] >> (i % 32)) & 1;
+            for (int j = 0; j < r->n; j++) {
+                uint32_t top = r->d[j] >> 31;
+                r->d[j] = (r->d[j] << 1) | bit;
+                bit = top;
+            }
+            if (bit) { r->d[r->n++] = bit; }
+            if (lbig_cmpabs(r, b) >= 0) {
+                lbig* t = lbig_subabs(r, b);
+                memcpy(r->d, t->d, sizeof(uint32_t) * t->n);
+                r->n = t->n;
+                free(t);
+                q->d[i / 32] |= 1u << (i % 32);
+            }
+        }
+        free(r);
+    }
+    q->sign = a->sign * b->sign;
+    lbig_trim(q);
+    return q;
+}
+
+/* read the decimal digits in s, with an optional leading - */
+lbig* lbig_read(char* s) {
+    int sign = 1;
+    if (*s == '-') { sign = -1; s++; }
+    lbig* b = lbig_new(strlen(s) / 9 + 2);
+    b->n = 0;
+    for (; *s; s++) {
+        uint64_t carry = *s - '0';
+        for (int i = 0; i < b->n; i++) {
+            carry += (uint64_t)b->d[i] * 10;
+            b->d[i] = (uint32_t)carry;
+            carry >>= 32;
+        }
+        if (carry) { b->d[b->n++] = (uint32_t)carry; }
+    }
+    b->sign = sign;
+    lbig_trim(b);
+    return b;
+}
+
+/* b in decimal, for the caller to free */
+char* lbig_str(lbig* b) {
+    /* nine digits at a time, least significant first */
+    lbig* t = lbig_copy(b);
+    int n = 0;
+    uint32_t* chunks = malloc(sizeof(uint32_t) * (t->n * 2 + 1));
+    do {
+        chunks[n++] = lbig_divsmall(t, 1000000000);
+    } while (t->n);
+    free(t);
+
+    char* str = malloc(n * 9 + 2);
+    char* p = str;
+    if (b->sign < 0) { *p++ = '-'; }
+    p += sprintf(p, "%u", chunks[n-1]);
+    for (int i = n-2; i >= 0; i--) {
+        p += sprintf(p, "%09u", chunks[i]);
+    }
+    free(chunks);
+    return str;
+}
+
 /* create a pointer to a new num lval */
 lval* lval_num(long x) {
-    lval* v = malloc(sizeof(lval));
-    v->type = LVAL_NUM;
+    if (x >= LVAL_SMALL_MIN && x <= LVAL_SMALL_MAX) {
+        return lval_ref(&lval_small[x - LVAL_SMALL_MIN]);
+    }
+
+    lval* v = lval_alloc(LVAL_NUM);
     v->num = x;
     return v;
 }
 
+lval* lval_dbl(double x) {
+    lval* v = lval_alloc(LVAL_DBL);
+    v->dbl = x;
+    return v;
+}
+
+/* an integer lval for b, which it takes; a plain num if it fits */
+lval* lval_big(lbig* b) {
+    long x;
+    if (lbig_to_long(b, &x)) {
+        free(b);
+        return lval_num(x);
+    }
+    lval* v = lval_alloc(LVAL_BIG);
+    v->big = b;
+    return v;
+}
+
+int lval_isnum(lval* v) {
+    return v->type == LVAL_NUM || v->type == LVAL_DBL || v->type == LVAL_BIG;
+}
+
+double lval_to_double(lval* v) {
+    switch (v->type) {
+        case LVAL_NUM: return v->num;
+        case LVAL_BIG: return lbig_to_double(v->big);
+        default: return v->dbl;
+    }
+}
+
+/* -1, 0 or 1 as x is less than, equal to or greater than y; 2 if
+ * they can't be ordered (a NaN) */
+int lval_numcmp(lval* x, lval* y) {
+    if (x->type == LVAL_NUM && y->type == LVAL_NUM) {
+        return (x->num > y->num) - (x->num < y->num);
+    }
+    if (x->type == LVAL_DBL || y->type == LVAL_DBL) {
+        double a = lval_to_double(x);
+        double b = lval_to_double(y);
+        if (a < b) { return -1; }
+        if (a > b) { return 1; }
+        return a == b ? 0 : 2;
+    }
+    lbig* a = x->type == LVAL_BIG ? x->big : lbig_from_long(x->num);
+    lbig* b = y->type == LVAL_BIG ? y->big : lbig_from_long(y->num);
+    int c = lbig_cmp(a, b);
+    if (a != x->big) { free(a); }
+    if (b != y->big) { free(b); }
+    return c;
+}
+
 /* create a pointer to a new err lval */
 lval* lval_err(char* fmt, ...) {
-    lval* v = malloc(sizeof(lval));
-    v->type = LVAL_ERR;
+    lval* v = lval_alloc(LVAL_ERR);
 
     /* varable list */
     va_list va;
@@ -96,45 +619,153 @@ lval* lval_err(char* fmt, ...) {
     return v;
 }
 
+/*
+ * symbol interning
+ *
+ * every distinct symbol name is stored exactly once, as an atom, and
+ * symbol lvals just point at their atom. two symbols are the same
+ * symbol if and only if they point at the same atom.
+ */
+
+struct latom {
+    /* FNV-1a of name, computed once for lenv lookups */
+    unsigned long hash;
+    /* how many envs other than the root bind it right now. every
+     * thread's envs count, so see latom_bind */
+    int bound;
+    char name[];
+};
+
+/* set once there are worker threads, see the parallel section */
+int lpar_started = 0;
+
+/* open-addressed table of every atom ever made; never shrinks */
+latom** atoms = NULL;
+int atom_count = 0;
+int atom_slots = 0;
+
+/* workers can intern too, so once there are any the table is locked */
+pthread_mutex_t atoms_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* the atom for "&", used when binding variadic formals */
+latom* latom_amp;
+
+unsigned long latom_hash(char* s, int n) {
+    unsigned long h = 2166136261UL;
+    for (int i = 0; i < n; i++) {
+        h ^= (unsigned char)s[i];
+        h *= 16777619UL;
+    }
+    return h;
+}
+
+/* s needn't end at n, so the reader can intern straight from its buffer */
+latom* latom_make(char* s, int n) {
+    unsigned long h = latom_hash(s, n);
+
+    /* grow when half full so probes stay short */
+    if (atom_count * 2 >= atom_slots) {
+        int slots = atom_slots ? atom_slots * 2 : 256;
+        latom** grown = calloc(slots, sizeof(latom*));
+        for (int i = 0; i < atom_slots; i++) {
+            if (!atoms[i]) { continue; }
+            unsigned long j = atoms[i]->hash & (slots - 1);
+            while (grown[j]) { j = (j + 1) & (slots - 1); }
+            grown[j] = atoms[i];
+        }
+        free(atoms);
+        atoms = grown;
+        atom_slots = slots;
+    }
+
+    unsigned long mask = atom_slots - 1;
+    unsigned long j = h & mask;
+    for (; atoms[j]; j = (j + 1) & mask) {
+        if (atoms[j]->hash == h && strncmp(atoms[j]->name, s, n) == 0
+                && atoms[j]->name[n] == '\0') {
+            return atoms[j];
+        }
+    }
+
+    latom* a = malloc(sizeof(latom) + n + 1);
+    a->hash = h;
+    a->bound = 0;
+    memcpy(a->name, s, n);
+    a->name[n] = '\0';
+    atoms[j] = a;
+    atom_count++;
+    return a;
+}
+
+/* find the atom for the n chars at s, making it if this is the first
+ * time we see it */
+latom* latom_intern_len(char* s, int n) {
+    if (!lpar_started) { return latom_make(s, n); }
+    pthread_mutex_lock(&atoms_lock);
+    latom* a = latom_make(s, n);
+    pthread_mutex_unlock(&atoms_lock);
+    return a;
+}
+
+latom* latom_intern(char* s) {
+    return latom_intern_len(s, strlen(s));
+}
+
+/* n more (or fewer) envs bind a */
+void latom_bind(latom* a, int n) {
+    if (lpar_started) {
+        __atomic_fetch_add(&a->bound, n, __ATOMIC_RELAXED);
+    } else {
+        a->bound += n;
+    }
+}
+
+void latom_cleanup(void) {
+    for (int i = 0; i < atom_slots; i++) {
+        free(atoms[i]);
+    }
+    free(atoms);
+    atoms = NULL;
+    atom_count = atom_slots = 0;
+}
+
 /* create a pointer to a new symbol lval */
 lval* lval_sym(char* s) {
-    lval* v = malloc(sizeof(lval));
-    v->type = LVAL_SYM;
-    v->sym = malloc(strlen(s)+1);
-    strcpy(v->sym, s);
+    lval* v = lval_alloc(LVAL_SYM);
+    v->sym = latom_intern(s);
     return v;
 }
 
 /* a new pointer to a function */
 lval* lval_fun(lbuiltin func) {
-    lval* v = malloc(sizeof(lval));
-    v->type = LVAL_FUN;
+    lval* v = lval_alloc(LVAL_FUN);
     v->builtin = func;
     return v;
 }
 
 /* a pointer to a new empty sexpr lval */
 lval* lval_sexpr(void) {
-    lval* v = malloc(sizeof(lval));
-    v->type = LVAL_SEXPR;
+    lval* v = lval_alloc(LVAL_SEXPR);
     v->count = 0;
     v->cell = NULL;
+    v->cells = NULL;
+    v->code = NULL;
     return v;
 }
 
 /* Qexpr pointer construction */
 lval* lval_qexpr(void) {
-    lval* v = malloc(sizeof(lval));
-    v->type = LVAL_QEXPR;
+    lval* v = lval_alloc(LVAL_QEXPR);
     v->count = 0;
     v->cell = NULL;
+    v->cells = NULL;
+    v->code = NULL;
     return v;
 }
 
 lval* lval_str(char* s) {
-    lval* v = malloc(sizeof(lval));
-    v->type = LVAL_STR;
-    v->str = malloc(sizeof(s) + 1);
+    lval* v = lval_alloc(LVAL_STR);
+    v->str = malloc(strlen(s) + 1);
     strcpy(v->str, s);
     return v;
 }
@@ -145,8 +776,7 @@ void lenv_del(lenv* e);
 /* constructing a user-created function
  * 'formals' are required variables, 'body' is computation to perform */
 lval* lval_lambda(lval* formals, lval* body) {
-    lval* v = malloc(sizeof(lval));
-    v->type = LVAL_FUN;
+    lval* v = lval_alloc(LVAL_FUN);
 
     /* NULL for non-builtin functions */
     v->builtin = NULL;
@@ -164,6 +794,10 @@ char* ltype_name (int t) {
     switch(t) {
         case LVAL_FUN: return "Function";
         case LVAL_NUM: return "Number";
+        case LVAL_DBL: return "Double";
+        case LVAL_BIG: return "Bignum";
+        case LVAL_VEC: return "Vector";
+        case LVAL_FUT: return "Future";
         case LVAL_ERR: return "Error";
         case LVAL_SYM: return "Symbol";
         case LVAL_STR: return "String";
@@ -176,22 +810,48 @@ char* ltype_name (int t) {
 /*
  * lenv setup
  */
+
+/* frames with at most this many entries are scanned linearly (comparing
+ * hashes first); bigger ones, like the global env, get a hash index */
+#define LENV_SCAN_MAX 8
+
 struct lenv {
     /* pointer to parent environment (NULL if global) */
     lenv* par;
+    /* -1 while sitting unused in the pool */
     int count;
-    /* list of strings */
-    char** syms;
+    /* set while the collector is tracing */
+    int mark;
+    /* list of interned symbols */
+    latom** syms;
     /* list of pointers */
     lval** vals;
+    /* room in the lists above */
+    int cap;
+
+    /* open-addressed index into the lists above, entries are i+1 and
+     * 0 is an empty slot. NULL until count passes LENV_SCAN_MAX */
+    int slots;
+    int* index;
+
+    /* for the env of a lambda, the name it was def'd as, if any. copies
+     * of the lambda (and their frames) copy it along */
+    latom* name;
 };
 
+__thread lpool lenv_pool = { "lenv", sizeof(lenv), offsetof(lenv, par) };
+
 lenv* lenv_new(void) {
-    lenv* e = malloc(sizeof(lenv));
+    lenv* e = lpool_get(&lenv_pool);
     e->par = NULL;
     e->count = 0;
+    e->mark = 0;
     e->syms = NULL;
     e->vals = NULL;
+    e->cap = 0;
+    e->slots = 0;
+    e->index = NULL;
+    e->name = NULL;
     return e;
 }
 
@@ -199,24 +859,39 @@ lenv* lenv_new(void) {
  * working with lvals
  */
 
+/* take another reference to v */
+lval* lval_ref(lval* v) {
+    v->refs++;
+    return v;
+}
+
+void lcode_del(lcode* c);
+ltask* ltask_ref(ltask* k);
+void ltask_drop(ltask* k);
+
+/* drop a reference to v, freeing it once nobody is left */
 void lval_del(lval* v) {
+    if (--v->refs > 0) { return; }
+
     switch (v->type) {
         /* nothing else to delete for nums or funcs */
         case LVAL_NUM: break;
+        case LVAL_DBL: break;
+        case LVAL_BIG: free(v->big); break;
+        case LVAL_VEC: free(v->ivec); free(v->dvec); break;
+        case LVAL_FUT: ltask_drop(v->task); break;
 
-        /* for err or sym free strings */
+        /* for err free strings; syms are interned and live forever */
         case LVAL_ERR: free(v->err); break;
-        case LVAL_SYM: free(v->sym); break;
+        case LVAL_SYM: break;
         case LVAL_STR: free(v->str); break;
 
-        /* sexpr and qexpr delete everything, recursively */
+        /* sexpr and qexpr delete everything, recursively, once
+         * nobody else is using the storage */
         case LVAL_QEXPR:
         case LVAL_SEXPR:
-            for (int i = 0; i < v->count; i++) {
-                lval_del(v->cell[i]);
-            }
-            /* and the pointer itself */
-            free(v->cell);
+            if (v->cells) { lcells_drop(v->cells); }
+            if (v->code) { lcode_del(v->code); }
         break;
         /* delete user functions but not builtins */
         case LVAL_FUN:
@@ -228,42 +903,196 @@ void lval_del(lval* v) {
         break;
     }
     /* and now the actual lval struct itself */
-    free(v);
+    lcount.frees[v->type]++;
+    v->type = LVAL_FREE;
+    lpool_put(&lval_pool, v);
+}
+
+/* any bytecode for a list is stale once the list changes */
+void lval_touch(lval* v) {
+    if (v->code) {
+        lcode_del(v->code);
+        v->code = NULL;
+    }
+}
+
+/* give v a block of its own with room for cap items */
+void lval_recell(lval* v, int cap) {
+    lcells* b = lcells_new(cap);
+    for (int i = 0; i < v->count; i++) {
+        b->items[i] = lval_ref(v->cell[i]);
+    }
+    b->hi = v->count;
+    if (v->cells) { lcells_drop(v->cells); }
+    v->cells = b;
+    v->cell = b->items;
+}
+
+/* make v's block its alone and exactly what v holds, so it can be
+ * changed in place */
+void lval_unshare(lval* v) {
+    lcells* b = v->cells;
+    if (!b) { return; }
+    if (b->refs > 1) { lval_recell(v, v->count); return; }
+
+    /* anything outside v was left by lists that have since gone */
+    int lo = v->cell - b->items;
+    for (int i = b->lo; i < lo; i++) { lval_del(b->items[i]); }
+    for (int i = lo + v->count; i < b->hi; i++) { lval_del(b->items[i]); }
+    b->lo = lo;
+    b->hi = lo + v->count;
+}
+
+/* make room for n more cells on the end of v */
+void lval_reserve(lval* v, int n) {
+    lcells* b = v->cells;
+
+    /* nobody has anything past our end, so the spare room is ours */
+    if (b && v->cell + v->count == b->items + b->hi && b->hi + n <= b->cap) {
+        return;
+    }
+
+    /* somebody else is using the block (or there isn't one yet) */
+    if (!b || b->refs > 1) {
+        int cap = 4;
+        while (cap < 2 * (v->count + n)) { cap *= 2; }
+        lval_recell(v, cap);
+        return;
+    }
+
+    lval_unshare(v);
+
+    /* once at least half the block has been popped off the front it's
+     * worth sliding down into; otherwise double it */
+    if (b->lo < v->count + n) {
+        int cap = b->cap ? b->cap * 2 : 4;
+        while (cap < v->count + n) { cap *= 2; }
+        memmove(b->items, v->cell, sizeof(lval*) * v->count);
+        b = realloc(b, sizeof(lcells) + sizeof(lval*) * cap);
+        b->cap = cap;
+    } else {
+        memmove(b->items, v->cell, sizeof(lval*) * v->count);
+    }
+    b->lo = 0;
+    b->hi = v->count;
+    v->cells = b;
+    v->cell = b->items;
 }
 
 lval* lval_add(lval* v, lval* x) {
-    /* update our pointer count */
-    v->count++;
+    lval_touch(v);
 
-    /* allocate more space for the pointer */
-    v->cell = realloc(v->cell, sizeof(lval*) * v->count);
+    /* make sure there's space for the pointer */
+    lval_reserve(v, 1);
 
     /* put the new pointer into the cell list */
-    v->cell[v->count-1] = x;
+    v->cell[v->count++] = x;
+    v->cells->hi++;
 
     /* return a pointer to the updated lval */
     return v;
 }
 
+/* v must be unshared; pass it through lval_own first if unsure */
 lval* lval_pop(lval* v, int i) {
+    lval_touch(v);
+
     /* Find the item at "i" */
     lval* x = v->cell[i];
-
-    /* Shift the memory following the item at "i" over the top of it */
-    memmove(&v->cell[i], &v->cell[i+1], sizeof(lval*) * (v->count-i-1));
+    lcells* b = v->cells;
+
+    /* the ends come off without disturbing the block: the item is moved
+     * out of it if it's on the edge of a block that's ours alone, and
+     * is otherwise borrowed from it. anything else shifts the memory
+     * following the item at "i" over the top of it */
+    if (i == 0 || i == v->count-1) {
+        int at = v->cell - b->items + i;
+        if (b->refs == 1 && at == b->lo) {
+            b->lo++;
+        } else if (b->refs == 1 && at == b->hi-1) {
+            b->hi--;
+        } else {
+            lval_ref(x);
+        }
+        if (i == 0) { v->cell++; }
+    } else {
+        lval_unshare(v);
+        b = v->cells;
+        memmove(&v->cell[i], &v->cell[i+1], sizeof(lval*) * (v->count-i-1));
+        b->hi--;
+    }
 
     /* Decrease the count of items in the list */
     v->count--;
-
-    /* Reallocate the memory used */
-    v->cell = realloc(v->cell, sizeof(lval*) * v->count);
+    if (b->lo == b->hi) {
+        b->lo = b->hi = 0;
+        if (b->refs == 1) { v->cell = b->items; }
+    }
 
     /* return the pointer we asked for;
      * v is MUTATED but still exists, sans pointer to x */
     return x;
 }
 
+lval* lval_own(lval* v);
+
+/* a new list of v's items from i on, consuming v. it shares v's
+ * storage unless that's turned off */
+lval* lval_slice(lval* v, int i) {
+    if (!lcells_shared) {
+        v = lval_own(v);
+        while (i--) { lval_del(lval_pop(v, 0)); }
+        return v;
+    }
+
+    lval* x = lval_alloc(v->type);
+    x->count = v->count - i;
+    x->cell = v->cell + i;
+    x->cells = v->cells;
+    x->cells->refs++;
+    x->code = NULL;
+    lval_del(v);
+    return x;
+}
+
+/* a new list of x followed by v's items, consuming both */
+lval* lval_cons(lval* x, lval* v) {
+    lval* n = lval_alloc(v->type);
+    n->count = v->count + 1;
+    n->code = NULL;
+
+    lcells* b = v->cells;
+    if (b && v->cell == b->items + b->lo && b->lo > 0) {
+        /* nobody has the slot just before v, so take it */
+        b->items[--b->lo] = x;
+        b->refs++;
+    } else {
+        /* start a block with room to cons onto again */
+        int cap = 4;
+        while (cap < 2 * n->count) { cap *= 2; }
+        b = lcells_new(cap);
+        b->lo = cap - n->count;
+        b->hi = cap;
+        b->items[b->lo] = x;
+        for (int i = 0; i < v->count; i++) {
+            b->items[b->lo+1+i] = lval_ref(v->cell[i]);
+        }
+    }
+    n->cells = b;
+    n->cell = b->items + b->lo;
+
+    lval_del(v);
+    return n;
+}
+
 lval* lval_take(lval* v, int i) {
+    /* someone else still needs v, so just borrow the item from it */
+    if (v->refs > 1) {
+        lval* x = lval_ref(v->cell[i]);
+        lval_del(v);
+        return x;
+    }
+
     /* pop the lval pointer we want out of v... */
     lval* x = lval_pop(v, i);
 
@@ -274,37 +1103,64 @@ lval* lval_take(lval* v, int i) {
     return x;
 }
 
-lenv* lenv_copy(lenv* e);
+lenv* lenv_copy(lenv* e, int room);
 
+/* copy the top level of v; anything it contains is shared, not copied */
 lval* lval_copy(lval* v) {
-    lval* x = malloc(sizeof(lval));
-    x->type = v->type;
+    lval* x = lval_alloc(v->type);
+    lcount.copies++;
+    lcount.copy_bytes += sizeof(lval);
 
     switch (v->type) {
         /* nums copy straight across */
         case LVAL_NUM: x->num = v->num; break;
+        case LVAL_DBL: x->dbl = v->dbl; break;
+        case LVAL_BIG: x->big = lbig_copy(v->big); break;
+        case LVAL_VEC:
+            x->vlen = v->vlen;
+            x->vdbl = v->vdbl;
+            x->ivec = NULL;
+            x->dvec = NULL;
+            if (v->vdbl) {
+                x->dvec = malloc(sizeof(double) * v->vlen);
+                memcpy(x->dvec, v->dvec, sizeof(double) * v->vlen);
+            } else {
+                x->ivec = malloc(sizeof(long) * v->vlen);
+                memcpy(x->ivec, v->ivec, sizeof(long) * v->vlen);
+            }
+            lcount.copy_bytes += sizeof(long) * v->vlen;
+        break;
+        /* futures are shared, as they only ever get the one value */
+        case LVAL_FUT: x->task = ltask_ref(v->task); break;
 
         /* strings copy using malloc and strcpy */
         case LVAL_ERR:
             x->err = malloc(strlen(v->err) + 1);
             strcpy(x->err, v->err); 
+            lcount.copy_bytes += strlen(v->err) + 1;
             break;
-        case LVAL_SYM:
-            x->sym = malloc(strlen(v->sym) + 1);
-            strcpy(x->sym, v->sym);
-            break;
+        case LVAL_SYM: x->sym = v->sym; break;
         case LVAL_STR:
             x->str = malloc(strlen(v->str) + 1);
             strcpy(x->str, v->str);
+            lcount.copy_bytes += strlen(v->str) + 1;
             break;
 
-        /* copy lists recursively */
+        /* a list looking at the same children; unless storage is
+         * shared that means a block of its own */
         case LVAL_SEXPR:
         case LVAL_QEXPR:
             x->count = v->count;
-            x->cell = malloc(sizeof(lval*) * x->count);
-            for (int i = 0; i < x->count; i++) {
-                x->cell[i] = lval_copy(v->cell[i]);
+            x->cell = v->cell;
+            x->cells = v->cells;
+            x->code = NULL;
+            if (!x->cells) { break; }
+            if (lcells_shared) {
+                x->cells->refs++;
+            } else {
+                x->cells = NULL;
+                lval_recell(x, x->count);
+                lcount.copy_bytes += sizeof(lval*) * x->count;
             }
         break;
 
@@ -314,9 +1170,11 @@ lval* lval_copy(lval* v) {
                 x->builtin = v->builtin;
             } else {
                 x->builtin = NULL;
-                x->env = lenv_copy(v->env);
-                x->formals = lval_copy(v->formals);
-                x->body = lval_copy(v->body);
+                x->env = lenv_copy(v->env, 0);
+                x->formals = lval_ref(v->formals);
+                x->body = lval_ref(v->body);
+                lcount.copy_bytes += sizeof(lenv) +
+                    (sizeof(latom*) + sizeof(lval*)) * v->env->count;
             }
         break;
     }
@@ -324,10 +1182,24 @@ lval* lval_copy(lval* v) {
     return x;
 }
 
+/* make sure we hold the only reference to v before mutating it,
+ * copying its top level if it is shared */
+lval* lval_own(lval* v) {
+    if (v->refs == 1) { return v; }
+    lval* x = lval_copy(v);
+    lval_del(v);
+    return x;
+}
+
 lval* lval_join(lval* x, lval* y) {
-    /* for each cell in y add it to x */
-    while(y->count) {
-        x = lval_add(x, lval_pop(y, 0));
+    /* copy y's cells across in one go; y may be shared so borrow them */
+    if (y->count) {
+        lval_touch(x);
+        lval_reserve(x, y->count);
+        for (int i = 0; i < y->count; i++) {
+            x->cell[x->count++] = lval_ref(y->cell[i]);
+        }
+        x->cells->hi += y->count;
     }
 
     /* clean up after ourselves */
@@ -340,189 +1212,407 @@ lval* builtin_eval(lenv* e, lval* a);
 void lenv_put(lenv* e, lval* k, lval* v);
 lval* builtin_list(lenv* e, lval* a);
 
-lval* lval_call(lenv* e, lval* f, lval* a) {
-    /* if a builtin, just do it */
-    if (f->builtin) { return f->builtin(e, a); }
+/* bind the arguments a into a fresh frame for the user function f,
+ * consuming a. f is left as it was, so it can be shared. returns an
+ * error, or a new function holding the arguments so far if f wants
+ * more of them, or NULL with the frame in *frame once f is ready to run */
+lval* lval_bind(lval* f, lval* a, lenv** frame) {
+    lval* formals = f->formals;
 
     /* record argument counts */
     int given = a->count;
-    int total = f->formals->count;
+    int total = formals->count;
 
-    /* while there's still arguments to process */
-    while(a->count) {
+    /* the frame starts with whatever f was partially given already */
+    lenv* n = lenv_copy(f->env, total);
+
+    int i = 0;
+    for (int j = 0; j < given; i++, j++) {
         /* we're only being clever if given < total */
-        if (f->formals->count == 0) {
-            lval_del(a);
+        if (i == total) {
+            lval_del(a); lenv_del(n);
             return lval_err(
                 "Function passed too many arguments; got %i expected %i.",
                 given, total);
         }
 
-        /* Pop the first symbol off */
-        lval* sym = lval_pop(f->formals, 0);
-
         /* Special Case to deal with '&' */
-        if (strcmp(sym->sym, "&") == 0) {
+        if (formals->cell[i]->sym == latom_amp) {
             /* make sure something else follows it */
-            if (f->formals->count != 1) {
-                lval_del(a);
+            if (total - i != 2) {
+                lval_del(a); lenv_del(n);
                 return lval_err("Format invalid; & not followed by single symbol");
             }
 
             /* next formal is bound to remaining arguments */
-            lval* nsym = lval_pop(f->formals, 0);
-            lenv_put(f->env, nsym, builtin_list(e, a));
-            lval_del(sym); lval_del(nsym);
+            lval* rest = lval_qexpr();
+            for (; j < given; j++) {
+                rest = lval_add(rest, lval_ref(a->cell[j]));
+            }
+            lenv_put(n, formals->cell[i+1], rest);
+            lval_del(rest);
+            i += 2;
             break;
         }
 
-        /* Pop the next argument */
-        lval* val = lval_pop(a, 0);
-        /* Bind a copy into the function's environment */
-        lenv_put(f->env, sym, val);
-        /* delete symbol and value */
-        lval_del(sym); lval_del(val);
+        lenv_put(n, formals->cell[i], a->cell[j]);
     }
 
     /* argument list is now bound, so that can go */
     lval_del(a);
 
     /* more '&' handling */
-    if (f->formals->count > 0 &&
-        strcmp(f->formals->cell[0]->sym, "&") == 0) {
-
+    if (i < total && formals->cell[i]->sym == latom_amp) {
         /* check our validity */
-        if (f->formals->count != 2) {
+        if (total - i != 2) {
+            lenv_del(n);
             return lval_err("Format invalid; & not followed by single symbol");
         }
 
-        /* pop and delete & */
-        lval_del(lval_pop(f->formals, 0));
-        /* pop next symbol and create empty list */
-        lval* sym = lval_pop(f->formals, 0);
+        /* bind the symbol after it to an empty list */
         lval* val = lval_qexpr();
-
-        /* bind to env and delete */
-        lenv_put(f->env, sym, val);
-        lval_del(sym); lval_del(val);
+        lenv_put(n, formals->cell[i+1], val);
+        lval_del(val);
+        i += 2;
     }
 
-    /* if we matched up, eval and return */
-    if (f->formals->count == 0) {
-        /* set env */
-        f->env->par = e;
+    /* if we matched up we're ready */
+    if (i == total) {
+        *frame = n;
+        return NULL;
+    }
 
-        /* evaluate */
-        return builtin_eval(f->env, lval_add(lval_sexpr(), lval_copy(f->body)));
-    } else {
-        /* otherwise, return a function "partially" evaluated */
-        return lval_copy(f);
+    /* otherwise hand back a partial waiting on the formals that are left */
+    lval* p = lval_alloc(LVAL_FUN);
+    p->builtin = NULL;
+    p->env = n;
+    p->formals = lval_qexpr();
+    for (; i < total; i++) {
+        p->formals = lval_add(p->formals, lval_ref(formals->cell[i]));
     }
+    p->body = lval_ref(f->body);
+    return p;
 }
 
-/* forward declaring this for lval_expr_print() */
-void lval_print(lval* v);
+/*
+ * printing
+ *
+ * values are written out as text into an lbuf, which either builds up
+ * a string or, given a file, writes itself out a chunk at a time, so
+ * printing even a huge list takes a handful of writes rather than a
+ * stdio call for every char.
+ */
 
-void lval_expr_print(lval* v, char open, char close) {
-    putchar(open);
-    for (int i = 0; i < v->count; i++) {
-        /* print value contained within */
-        lval_print(v->cell[i]);
+/* how much to gather before writing it out */
+#define LBUF_CHUNK 65536
 
-        /* trailing space, skipped if last run */
-        if (i != (v->count-1)) {
-            putchar(' ');
-        }
+typedef struct lbuf {
+    char* data;
+    long len;
+    long cap;
+    /* where it's going, or NULL to keep it all */
+    FILE* f;
+} lbuf;
+
+void lbuf_flush(lbuf* b) {
+    if (b->f && b->len) { fwrite(b->data, 1, b->len, b->f); }
+    b->len = 0;
+}
+
+/* make room for n more chars */
+void lbuf_room(lbuf* b, long n) {
+    if (b->f && b->len + n > LBUF_CHUNK) { lbuf_flush(b); }
+    if (b->len + n > b->cap) {
+        while (b->len + n > b->cap) { b->cap = b->cap ? b->cap * 2 : 256; }
+        b->data = realloc(b->data, b->cap);
     }
-    putchar(close);
 }
 
-void lval_print_str(lval* v) {
-    char* escaped = malloc(strlen(v->str) + 1);
-    strcpy(escaped, v->str);
-    escaped = mpcf_escape(escaped);
-    printf("\"%s\"", escaped);
-    free(escaped);
+void lbuf_char(lbuf* b, char c) {
+    lbuf_room(b, 1);
+    b->data[b->len++] = c;
 }
 
-/* this was forward-declared */
-void lval_print(lval* v) {
-    switch (v->type) {
-        case LVAL_NUM: printf("%li", v->num); break;
-        case LVAL_ERR: printf("Error: %s", v->err); break;
-        case LVAL_SYM: printf("%s", v->sym); break;
-        case LVAL_STR: lval_print_str(v); break;
-        /* recurse if it's an sexpr */
-        case LVAL_SEXPR: lval_expr_print(v, '(', ')'); break;
-        case LVAL_QEXPR: lval_expr_print(v, '{', '}'); break;
-        /* functions are a little complicated */
-        case LVAL_FUN:
-            if (v->builtin) {
-                printf("<builtin>");
-            } else {
-                printf("(\\ ");
-                lval_print(v->formals);
-                putchar(' ');
-                lval_print(v->body);
-                putchar(')');
-            }
-        break;
-    }   
+void lbuf_add(lbuf* b, const char* s, long n) {
+    lbuf_room(b, n);
+    memcpy(b->data + b->len, s, n);
+    b->len += n;
 }
 
-void lval_println(lval* v) {
-    /* little util for printing lines */
-    lval_print(v);
-    putchar('\n');
+void lbuf_str(lbuf* b, const char* s) {
+    lbuf_add(b, s, strlen(s));
 }
 
-/*
- * working with lenvs
- */
+void lbuf_long(lbuf* b, long x) {
+    char digits[24];
+    int n = sizeof(digits);
+    /* negated as unsigned, so LONG_MIN is fine */
+    unsigned long u = x < 0 ? 0UL - (unsigned long)x : (unsigned long)x;
+    do {
+        digits[--n] = '0' + u % 10;
+        u /= 10;
+    } while (u);
+    if (x < 0) { digits[--n] = '-'; }
+    lbuf_add(b, digits + n, sizeof(digits) - n);
+}
 
-void lenv_del(lenv* e) {
-    for (int i = 0; i < e->count; i++) {
-        free(e->syms[i]);
+/* what mpcf_escape writes for c, or NULL if c stays as it is */
+char* lchar_escape(char c) {
+    switch (c) {
+        case '\a': return "\\a";
+        case '\b': return "\\b";
+        case '\f': return "\\f";
+        case '\n': return "\\n";
+        case '\r': return "\\r";
+        case '\t': return "\\t";
+        case '\v': return "\\v";
+        case '\\': return "\\\\";
+        case '\'': return "\\'";
+        case '\"': return "\\\"";
+    }
+    return NULL;
+}
+
+/* forward declaring this for lval_write_expr() */
+void lval_write(lbuf* b, lval* v);
+
+void lval_write_expr(lbuf* b, lval* v, char open, char close) {
+    lbuf_char(b, open);
+    for (int i = 0; i < v->count; i++) {
+        /* write value contained within */
+        lval_write(b, v->cell[i]);
+
+        /* trailing space, skipped if last run */
+        if (i != (v->count-1)) {
+            lbuf_char(b, ' ');
+        }
+    }
+    lbuf_char(b, close);
+}
+
+/* quoted and escaped. every escape is two chars, so room for the worst
+ * case is made up front and it's written straight in */
+void lval_write_str(lbuf* b, char* s) {
+    lbuf_room(b, 2 * strlen(s) + 2);
+    char* out = b->data + b->len;
+    *out++ = '"';
+    for (; *s; s++) {
+        char* esc = lchar_escape(*s);
+        if (esc) {
+            *out++ = esc[0];
+            *out++ = esc[1];
+        } else {
+            *out++ = *s;
+        }
+    }
+    *out++ = '"';
+    b->len = out - b->data;
+}
+
+/* as few digits as read back the same, and always with a point or
+ * exponent so they do read back as a double */
+void lval_write_dbl(lbuf* b, double x) {
+    char buf[40];
+    for (int prec = 15; prec <= 17; prec++) {
+        snprintf(buf, sizeof(buf), "%.*g", prec, x);
+        if (strtod(buf, NULL) == x) { break; }
+    }
+    if (!strpbrk(buf, ".eEn")) { strcat(buf, ".0"); }
+    lbuf_str(b, buf);
+}
+
+void lval_write_big(lbuf* b, lval* v) {
+    char* s = lbig_str(v->big);
+    lbuf_str(b, s);
+    free(s);
+}
+
+void lval_write_vec(lbuf* b, lval* v) {
+    lbuf_char(b, '[');
+    for (int i = 0; i < v->vlen; i++) {
+        if (i) { lbuf_char(b, ' '); }
+        if (v->vdbl) {
+            lval_write_dbl(b, v->dvec[i]);
+        } else {
+            lbuf_long(b, v->ivec[i]);
+        }
+    }
+    lbuf_char(b, ']');
+}
+
+/* this was forward-declared */
+void lval_write(lbuf* b, lval* v) {
+    switch (v->type) {
+        case LVAL_NUM: lbuf_long(b, v->num); break;
+        case LVAL_DBL: lval_write_dbl(b, v->dbl); break;
+        case LVAL_BIG: lval_write_big(b, v); break;
+        case LVAL_VEC: lval_write_vec(b, v); break;
+        case LVAL_FUT: lbuf_str(b, "<future>"); break;
+        case LVAL_ERR: lbuf_str(b, "Error: "); lbuf_str(b, v->err); break;
+        case LVAL_SYM: lbuf_str(b, v->sym->name); break;
+        case LVAL_STR: lval_write_str(b, v->str); break;
+        /* recurse if it's an sexpr */
+        case LVAL_SEXPR: lval_write_expr(b, v, '(', ')'); break;
+        case LVAL_QEXPR: lval_write_expr(b, v, '{', '}'); break;
+        /* functions are a little complicated */
+        case LVAL_FUN:
+            if (v->builtin) {
+                lbuf_str(b, "<builtin>");
+            } else {
+                lbuf_str(b, "(\\ ");
+                lval_write(b, v->formals);
+                lbuf_char(b, ' ');
+                lval_write(b, v->body);
+                lbuf_char(b, ')');
+            }
+        break;
+    }
+}
+
+/* v, then end if it's not 0, to stdout */
+void lval_print_end(lval* v, char end) {
+    lbuf b = { NULL, 0, 0, stdout };
+    lval_write(&b, v);
+    if (end) { lbuf_char(&b, end); }
+    lbuf_flush(&b);
+    free(b.data);
+}
+
+void lval_print(lval* v) {
+    lval_print_end(v, 0);
+}
+
+void lval_println(lval* v) {
+    /* little util for printing lines */
+    lval_print_end(v, '\n');
+}
+
+/*
+ * working with lenvs
+ */
+
+/* the global env. scoping is dynamic, so which frame a name inside a
+ * lambda resolves to isn't known until the call; but a name that no
+ * frame apart from this one binds (every builtin, most defs) can only
+ * ever resolve here, and lenv_get goes straight to it */
+__thread lenv* lenv_root = NULL;
+
+/* set in worker threads, whose root is only their own, see lpar_import */
+__thread int lpar_worker = 0;
+
+/* e is going away; its names no longer count as bound */
+void lenv_unbind(lenv* e) {
+    if (e == lenv_root) { return; }
+    for (int i = 0; i < e->count; i++) {
+        latom_bind(e->syms[i], -1);
+    }
+}
+
+void lenv_del(lenv* e) {
+    lenv_unbind(e);
+    for (int i = 0; i < e->count; i++) {
         lval_del(e->vals[i]);
     }
     free(e->syms);
     free(e->vals);
-    free(e);
+    free(e->index);
+    e->count = -1;
+    lpool_put(&lenv_pool, e);
+}
+
+/* find the position of k in this frame only, or -1 */
+int lenv_find(lenv* e, latom* k) {
+    if (!e->index) {
+        for (int i = 0; i < e->count; i++) {
+            if (e->syms[i] == k) { return i; }
+        }
+        return -1;
+    }
+
+    /* linear probing; slots is a power of two and never more than half full */
+    unsigned long mask = e->slots - 1;
+    for (unsigned long s = k->hash & mask; e->index[s]; s = (s + 1) & mask) {
+        int i = e->index[s] - 1;
+        if (e->syms[i] == k) { return i; }
+    }
+    return -1;
 }
 
+/* (re)build the hash index with room for at least twice count entries */
+void lenv_reindex(lenv* e) {
+    int slots = 16;
+    while (slots < e->count * 2) { slots *= 2; }
+
+    free(e->index);
+    e->slots = slots;
+    e->index = calloc(slots, sizeof(int));
+
+    unsigned long mask = slots - 1;
+    for (int i = 0; i < e->count; i++) {
+        unsigned long s = e->syms[i]->hash & mask;
+        while (e->index[s]) { s = (s + 1) & mask; }
+        e->index[s] = i + 1;
+    }
+}
+
+lval* lpar_import(lval* k);
+
 /* get existing lval from lenv */
 lval* lenv_get(lenv* e, lval* k) {
-    for (int i = 0; i < e->count; i++) {
-        if (strcmp(e->syms[i], k->sym) == 0) {
-            return lval_copy(e->vals[i]);
-        }
+    if (!__atomic_load_n(&k->sym->bound, __ATOMIC_RELAXED) && lenv_root) {
+        e = lenv_root;
     }
 
-    /* if we couldn't find anything at this level, check the parents */
-    if (e->par) {
-        return lenv_get(e->par, k);
-    } else {
-        return lval_err("Unknown symbol '%s'", k->sym);
+    /* walk up the parents until someone has it */
+    lcount.lookups++;
+    for (; e; e = e->par) {
+        lcount.lookup_frames++;
+        int i = lenv_find(e, k->sym);
+        if (i >= 0) { return lval_ref(e->vals[i]); }
     }
+    if (lpar_worker) { return lpar_import(k); }
+    return lval_err("Unknown symbol '%s'", k->sym->name);
 }
 
 /* put new lval into the local lenv */
 void lenv_put(lenv* e, lval* k, lval* v) {
-    for (int i = 0; i < e->count; i++) {
-        if (strcmp(e->syms[i], k->sym) == 0) {
-            lval_del(e->vals[i]);
-            e->vals[i] = lval_copy(v);
-            return;
-        }
+    int i = lenv_find(e, k->sym);
+    if (i >= 0) {
+        lval* old = e->vals[i];
+        e->vals[i] = lval_ref(v);
+        lval_del(old);
+        return;
     }
 
     e->count++;
-    e->vals = realloc(e->vals, sizeof(lval*) * e->count);
-    e->syms = realloc(e->syms, sizeof(char*) * e->count);
+    if (e->count > e->cap) {
+        e->cap = e->cap ? e->cap * 2 : 4;
+        e->vals = realloc(e->vals, sizeof(lval*) * e->cap);
+        e->syms = realloc(e->syms, sizeof(latom*) * e->cap);
+    }
+
+    e->vals[e->count-1] = lval_ref(v);
+    e->syms[e->count-1] = k->sym;
+    if (e != lenv_root) { latom_bind(k->sym, 1); }
+
+    /* keep the index at most half full, building it once we outgrow a scan */
+    if (e->index && e->count * 2 <= e->slots) {
+        unsigned long mask = e->slots - 1;
+        unsigned long s = k->sym->hash & mask;
+        while (e->index[s]) { s = (s + 1) & mask; }
+        e->index[s] = e->count;
+    } else if (e->count > LENV_SCAN_MAX) {
+        lenv_reindex(e);
+    }
+}
 
-    e->vals[e->count-1] = lval_copy(v);
-    e->syms[e->count-1] = malloc(strlen(k->sym) + 1);
-    strcpy(e->syms[e->count-1], k->sym);
+/* does n bind every name that e does? if so, nothing looked up
+ * through n can ever see e */
+int lenv_shadows(lenv* n, lenv* e) {
+    for (int i = 0; i < e->count; i++) {
+        if (lenv_find(n, e->syms[i]) < 0) { return 0; }
+    }
+    return 1;
 }
 
 /* add an lval to the global environment */
@@ -534,25 +1624,280 @@ void lenv_def(lenv* e, lval* k, lval* v) {
     lenv_put(e, k, v);
 }
 
-/* copy an lenv */
-lenv* lenv_copy(lenv* e) {
-    lenv* n = malloc(sizeof(lenv));
+/* copy an lenv, leaving room for that many more names */
+lenv* lenv_copy(lenv* e, int room) {
+    lenv* n = lpool_get(&lenv_pool);
     n->par = e->par;
     n->count = e->count;
-    n->syms = malloc(sizeof(char*) * n->count);
-    n->vals = malloc(sizeof(lval*) * n->count);
+    n->mark = 0;
+    n->cap = e->count + room;
+    n->syms = malloc(sizeof(latom*) * n->cap);
+    n->vals = malloc(sizeof(lval*) * n->cap);
+    if (e->count) { memcpy(n->syms, e->syms, sizeof(latom*) * n->count); }
     for (int i = 0; i < e->count; ++i) {
-        n->syms[i] = malloc(strlen(e->syms[i]) + 1);
-        strcpy(n->syms[i], e->syms[i]);
-        n->vals[i] = lval_copy(e->vals[i]);
+        n->vals[i] = lval_ref(e->vals[i]);
+        latom_bind(n->syms[i], 1);
     }
+    n->slots = 0;
+    n->index = NULL;
+    n->name = e->name;
+    if (n->count > LENV_SCAN_MAX) { lenv_reindex(n); }
     return n;
 }
 
+/* seconds since some fixed point, for timing things */
+double lclock(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * garbage collection
+ *
+ * reference counts free almost everything the moment it's dropped, but
+ * they never see values that were leaked on an error path or that end
+ * up owning themselves. with --gc the main loop also traces the heap
+ * between top-level expressions, when everything still in use must be
+ * reachable from the global environment or from a future, and sweeps
+ * whatever isn't.
+ */
+
+/* don't bother collecting a heap smaller than this many objects */
+#define GC_MIN_OBJECTS 4096
+
+int gc_enabled = 0;
+int gc_stats = 0;
+/* set by the gc builtin; honoured at the next safe point */
+int gc_requested = 0;
+
+/* collect once live objects pass this, then double what survived */
+long gc_threshold = GC_MIN_OBJECTS;
+
+long gc_collections = 0;
+long gc_reclaimed = 0;
+long gc_live = 0;
+unsigned long gc_live_bytes = 0;
+double gc_pause_total = 0;
+double gc_pause_max = 0;
+
+void gc_mark_lenv(lenv* e);
+void gc_mark_lcode(lcode* c);
+
+void gc_mark_lval(lval* v) {
+    if (v->mark) { return; }
+    v->mark = 1;
+
+    switch (v->type) {
+        case LVAL_SEXPR:
+        case LVAL_QEXPR:
+            /* everything in the block is held, not just what v sees */
+            if (v->cells && !v->cells->mark) {
+                lcells* b = v->cells;
+                b->mark = 1;
+                for (int i = b->lo; i < b->hi; i++) {
+                    gc_mark_lval(b->items[i]);
+                }
+            }
+            if (v->code) { gc_mark_lcode(v->code); }
+        break;
+        case LVAL_FUN:
+            if (!v->builtin) {
+                gc_mark_lenv(v->env);
+                gc_mark_lval(v->formals);
+                gc_mark_lval(v->body);
+            }
+        break;
+    }
+}
+
+/* par isn't followed: it's only borrowed, and only meaningful mid-call */
+void gc_mark_lenv(lenv* e) {
+    if (e->mark) { return; }
+    e->mark = 1;
+    for (int i = 0; i < e->count; i++) {
+        gc_mark_lval(e->vals[i]);
+    }
+}
+
+/* garbage is about to vanish without going through lval_del, so give
+ * back any references it holds on values that are staying */
+void gc_unref(lval* v) {
+    if (v->mark) { v->refs--; }
+}
+
+void gc_unref_lcode(lcode* c);
+void gc_free_lcode(lcode* c);
+
+/* futures found to be garbage, let go of once the sweep is done */
+ltask** gc_tasks = NULL;
+int gc_ntasks = 0;
+int gc_taskcap = 0;
+
+void gc_sweep(void) {
+    /* first pass: garbage lets go of the live values it points at */
+    for (int s = 0; s < lval_pool.nslabs; s++) {
+        lval* slab = lval_pool.slabs[s];
+        for (int i = 0; i < LPOOL_SLAB; i++) {
+            lval* v = &slab[i];
+            if (v->type == LVAL_FREE || v->mark) { continue; }
+            if (v->type == LVAL_SEXPR || v->type == LVAL_QEXPR) {
+                /* a dead block is only seen by garbage, so the last of
+                 * it to let go can free it now */
+                lcells* b = v->cells;
+                if (b && --b->refs == 0) {
+                    for (int j = b->lo; j < b->hi; j++) { gc_unref(b->items[j]); }
+                    free(b);
+                }
+                if (v->code) { gc_unref_lcode(v->code); }
+            }
+            if (v->type == LVAL_FUN && !v->builtin) {
+                gc_unref(v->formals);
+                gc_unref(v->body);
+            }
+        }
+    }
+    for (int s = 0; s < lenv_pool.nslabs; s++) {
+        lenv* slab = lenv_pool.slabs[s];
+        for (int i = 0; i < LPOOL_SLAB; i++) {
+            lenv* e = &slab[i];
+            if (e->count < 0 || e->mark) { continue; }
+            for (int j = 0; j < e->count; j++) { gc_unref(e->vals[j]); }
+        }
+    }
+
+    /* second pass: free the garbage and reset marks on the survivors */
+    for (int s = 0; s < lval_pool.nslabs; s++) {
+        lval* slab = lval_pool.slabs[s];
+        for (int i = 0; i < LPOOL_SLAB; i++) {
+            lval* v = &slab[i];
+            if (v->type == LVAL_FREE) { continue; }
+            if (v->mark) {
+                v->mark = 0;
+                if ((v->type == LVAL_SEXPR || v->type == LVAL_QEXPR) && v->cells) {
+                    v->cells->mark = 0;
+                }
+                continue;
+            }
+
+            switch (v->type) {
+                case LVAL_ERR: free(v->err); break;
+                case LVAL_STR: free(v->str); break;
+                case LVAL_BIG: free(v->big); break;
+                case LVAL_VEC: free(v->ivec); free(v->dvec); break;
+                case LVAL_SEXPR:
+                case LVAL_QEXPR:
+                    if (v->code) { gc_free_lcode(v->code); }
+                break;
+                case LVAL_FUT:
+                    if (gc_ntasks == gc_taskcap) {
+                        gc_taskcap = gc_taskcap ? gc_taskcap * 2 : 16;
+                        gc_tasks = realloc(gc_tasks, sizeof(ltask*) * gc_taskcap);
+                    }
+                    gc_tasks[gc_ntasks++] = v->task;
+                break;
+            }
+            lcount.frees[v->type]++;
+            v->type = LVAL_FREE;
+            lpool_put(&lval_pool, v);
+            gc_reclaimed++;
+        }
+    }
+    for (int s = 0; s < lenv_pool.nslabs; s++) {
+        lenv* slab = lenv_pool.slabs[s];
+        for (int i = 0; i < LPOOL_SLAB; i++) {
+            lenv* e = &slab[i];
+            if (e->count < 0) { continue; }
+            if (e->mark) { e->mark = 0; continue; }
+
+            lenv_unbind(e);
+            free(e->syms);
+            free(e->vals);
+            free(e->index);
+            e->count = -1;
+            lpool_put(&lenv_pool, e);
+            gc_reclaimed++;
+        }
+    }
+}
+
+void ltask_gc_begin(void);
+void ltask_gc_end(void);
+void ltask_drop(ltask* k);
+
+/* only call this with nothing but e, keep (if there's anything else
+ * main is still holding on to) and futures holding values */
+void gc_collect(lenv* e, lval* keep) {
+    double start = lclock();
+
+    ltask_gc_begin();
+    gc_mark_lenv(e);
+    if (keep) { gc_mark_lval(keep); }
+    gc_sweep();
+    ltask_gc_end();
+
+    /* dropping a future can free values, so not until the heap's whole */
+    for (int i = 0; i < gc_ntasks; i++) { ltask_drop(gc_tasks[i]); }
+    gc_ntasks = 0;
+
+    double pause = lclock() - start;
+    gc_pause_total += pause;
+    if (pause > gc_pause_max) { gc_pause_max = pause; }
+
+    gc_collections++;
+    gc_live = lval_pool.live + lenv_pool.live;
+    gc_live_bytes = lval_pool.live * lval_pool.size + lenv_pool.live * lenv_pool.size;
+    gc_threshold = gc_live * 2 > GC_MIN_OBJECTS ? gc_live * 2 : GC_MIN_OBJECTS;
+    gc_requested = 0;
+}
+
+void lthread_drain(void);
+
+/* the main loop's safe point */
+void gc_maybe_collect(lenv* e, lval* keep) {
+    lthread_drain();
+    if (gc_requested ||
+        (gc_enabled && lval_pool.live + lenv_pool.live > gc_threshold)) {
+        gc_collect(e, keep);
+    }
+}
+
+void gc_print_stats(void) {
+    printf("gc: %ld collections, %ld objects reclaimed\n",
+        gc_collections, gc_reclaimed);
+    printf("gc: pauses %.3fms total, %.3fms max\n",
+        gc_pause_total * 1000, gc_pause_max * 1000);
+    printf("gc: %ld objects (%lu bytes) live after last collection, %ld now\n",
+        gc_live, gc_live_bytes, lval_pool.live + lenv_pool.live);
+}
+
+/* the counters, for --stats */
+void lstats_print(void) {
+    printf("stats: %ld evals, %ld calls (%ld builtin, %ld lambda)\n",
+        lcount.evals, lcount.builtin_calls + lcount.lambda_calls,
+        lcount.builtin_calls, lcount.lambda_calls);
+    printf("stats: %ld copies, %ld bytes copied\n", lcount.copies, lcount.copy_bytes);
+    printf("stats: %ld lookups, %.2f envs walked on average\n", lcount.lookups,
+        lcount.lookups ? (double)lcount.lookup_frames / lcount.lookups : 0.0);
+    printf("stats: lvals made/freed:");
+    for (int t = 0; t <= LVAL_FUT; t++) {
+        if (!lcount.allocs[t] && !lcount.frees[t]) { continue; }
+        printf(" %s %ld/%ld", lstats_types[t], lcount.allocs[t], lcount.frees[t]);
+    }
+    printf("\n");
+    printf("stats: %ld lvals live, %ld at peak; %ld envs live, %ld at peak\n",
+        lval_pool.live, lval_pool.peak, lenv_pool.live, lenv_pool.peak);
+}
+
 /* test if two lvals are equal 
  * works recursively, checking only relevant fields 
  * zero is falsy, everything else is truthy */
 int lval_eq(lval* x, lval* y) {
+    /* numbers are equal if their values are, whatever kind they are */
+    if (lval_isnum(x) && lval_isnum(y)) {
+        return lval_numcmp(x, y) == 0;
+    }
+
     if (x->type != y->type) {
         return 0;
     }
@@ -561,8 +1906,21 @@ int lval_eq(lval* x, lval* y) {
     switch (x->type) {
         case LVAL_NUM: return (x->num == y->num);
         case LVAL_ERR: return (strcmp(x->err, y->err) == 0);
-        case LVAL_SYM: return (strcmp(x->sym, y->sym) == 0);
+        case LVAL_SYM: return (x->sym == y->sym);
         case LVAL_STR: return (strcmp(x->str, y->str) == 0);
+        case LVAL_FUT: return x->task == y->task;
+        case LVAL_VEC:
+            if (x->vlen != y->vlen) { return 0; }
+            for (int i = 0; i < x->vlen; i++) {
+                if (x->vdbl || y->vdbl) {
+                    double a = x->vdbl ? x->dvec[i] : x->ivec[i];
+                    double b = y->vdbl ? y->dvec[i] : y->ivec[i];
+                    if (a != b) { return 0; }
+                } else if (x->ivec[i] != y->ivec[i]) {
+                    return 0;
+                }
+            }
+            return 1;
         case LVAL_FUN: 
             if (x->builtin || y->builtin) {
                 return x->builtin == y->builtin;
@@ -591,97 +1949,185 @@ lval* lval_eval(lenv* e, lval* v);
  * builtin operations
  */
 
-lval* builtin_op(lenv* e, lval* a, char* op) {
+/* the operations the shared builtins below do, and their names */
+enum {
+    LBI_ADD, LBI_SUB, LBI_MUL, LBI_DIV,
+    LBI_GT, LBI_LT, LBI_GE, LBI_LE,
+    LBI_EQ, LBI_NE,
+    LBI_DEF, LBI_PUT,
+};
+
+char* lbi_names[] = {
+    "+", "-", "*", "/",
+    ">", "<", ">=", "<=",
+    "==", "!=",
+    "def", "=",
+};
+
+/* x op y for any two numbers, leaving them be */
+lval* lval_arith(int op, lval* x, lval* y) {
+    if (x->type == LVAL_DBL || y->type == LVAL_DBL) {
+        double a = lval_to_double(x);
+        double b = lval_to_double(y);
+        switch (op) {
+            case LBI_ADD: return lval_dbl(a + b);
+            case LBI_SUB: return lval_dbl(a - b);
+            case LBI_MUL: return lval_dbl(a * b);
+            default:
+                if (b == 0) { return lval_err("Division By Zero!"); }
+                return lval_dbl(a / b);
+        }
+    }
+
+    lbig* a = x->type == LVAL_BIG ? lbig_copy(x->big) : lbig_from_long(x->num);
+    lbig* b = y->type == LVAL_BIG ? lbig_copy(y->big) : lbig_from_long(y->num);
+    lbig* c = NULL;
+    switch (op) {
+        case LBI_ADD: c = lbig_add(a, b, 1); break;
+        case LBI_SUB: c = lbig_add(a, b, -1); break;
+        case LBI_MUL: c = lbig_mul(a, b); break;
+        default:
+            if (b->n) { c = lbig_div(a, b); }
+        break;
+    }
+    free(a); free(b);
+    return c ? lval_big(c) : lval_err("Division By Zero!");
+}
+
+lval* builtin_op(lenv* e, lval* a, int op) {
+    LASSERT(a, a->count > 0, "Function %s passed no arguments!", lbi_names[op]);
+
     /* Ensure all arguments are numbers */
     for (int i = 0; i < a->count; i++) {
-        if (a->cell[i]->type != LVAL_NUM) {
+        if (!lval_isnum(a->cell[i])) {
             lval_del(a);
             return lval_err("Cannot operate on non number!");
         }
     }
-    
-    /* Pop the first element */
-    lval* x = lval_pop(a, 0);
+
+    lval** y = a->cell;
+    int n = a->count;
+    int fits = y[0]->type == LVAL_NUM;
+    long x = y[0]->num;
+    long r;
+    int i = 1;
 
     /* If no arguments and sub then perform unary negation */
-    if ((strcmp(op, "-") == 0) && a->count == 0) { x->num = -x->num; }
-
-    /* While there are still elements remaining */
-    while (a->count > 0) {
-
-        /* Pop the next element */
-        lval* y = lval_pop(a, 0);
-
-        /* Perform operation */
-        if (strcmp(op, "+") == 0) { x->num += y->num; }
-        if (strcmp(op, "-") == 0) { x->num -= y->num; }
-        if (strcmp(op, "*") == 0) { x->num *= y->num; }
-        if (strcmp(op, "/") == 0) {
-            if (y->num == 0) {
-                lval_del(x); lval_del(y);
-                x = lval_err("Division By Zero!"); break;
-            } else {
-                x->num /= y->num;
-            }
+    if (n == 1 && op == LBI_SUB) {
+        lval* z = lval_num(0);
+        lval* v = fits && x != LONG_MIN ? lval_num(-x) : lval_arith(op, z, y[0]);
+        lval_del(z); lval_del(a);
+        return v;
+    }
+
+    /* accumulate straight over the arguments while they're plain nums
+     * and the result fits in one; whatever stops that is picked up by
+     * the general case after */
+    if (fits) {
+        switch (op) {
+            case LBI_ADD:
+                for (; i < n && y[i]->type == LVAL_NUM; i++) {
+                    if (__builtin_add_overflow(x, y[i]->num, &r)) { break; }
+                    x = r;
+                }
+            break;
+            case LBI_SUB:
+                for (; i < n && y[i]->type == LVAL_NUM; i++) {
+                    if (__builtin_sub_overflow(x, y[i]->num, &r)) { break; }
+                    x = r;
+                }
+            break;
+            case LBI_MUL:
+                for (; i < n && y[i]->type == LVAL_NUM; i++) {
+                    if (__builtin_mul_overflow(x, y[i]->num, &r)) { break; }
+                    x = r;
+                }
+            break;
+            case LBI_DIV:
+                for (; i < n && y[i]->type == LVAL_NUM; i++) {
+                    if (y[i]->num == 0) {
+                        lval_del(a);
+                        return lval_err("Division By Zero!");
+                    }
+                    if (x == LONG_MIN && y[i]->num == -1) { break; }
+                    x /= y[i]->num;
+                }
+            break;
+        }
+        if (i == n) {
+            lval_del(a);
+            return lval_num(x);
         }
+    }
 
-        /* Delete element now finished with */
-        lval_del(y);
+    /* carry on one at a time with bignums and doubles */
+    lval* acc = fits ? lval_num(x) : lval_ref(y[0]);
+    for (; i < n && acc->type != LVAL_ERR; i++) {
+        lval* v = lval_arith(op, acc, y[i]);
+        lval_del(acc);
+        acc = v;
     }
 
     /* Delete input expression and return result */
     lval_del(a);
-    return x;
+    return acc;
 }
 
 /* greater/less than? */
-lval* builtin_ord(lenv* e, lval* a, char* op) {
-    LASSERT_NUM(op, a, 2);
-    LASSERT_TYPE(op, a, 0, LVAL_NUM);
-    LASSERT_TYPE(op, a, 1, LVAL_NUM);
-
-    int r;
-    if (strcmp(op, ">")  == 0) { r = (a->cell[0]->num >  a->cell[1]->num); }
-    if (strcmp(op, "<")  == 0) { r = (a->cell[0]->num <  a->cell[1]->num); }
-    if (strcmp(op, ">=") == 0) { r = (a->cell[0]->num >= a->cell[1]->num); }
-    if (strcmp(op, "<=") == 0) { r = (a->cell[0]->num <= a->cell[1]->num); }
+lval* builtin_ord(lenv* e, lval* a, int op) {
+    LASSERT_NUM(lbi_names[op], a, 2);
+    for (int i = 0; i < 2; i++) {
+        LASSERT(a, lval_isnum(a->cell[i]),
+            "Function %s passed bad type for arg %i. Got %s, expected %s.",
+            lbi_names[op], i, ltype_name(a->cell[i]->type), ltype_name(LVAL_NUM));
+    }
+
+    int c = lval_numcmp(a->cell[0], a->cell[1]);
+    int r = 0;
+    switch (op) {
+        case LBI_GT: r = (c == 1); break;
+        case LBI_LT: r = (c == -1); break;
+        case LBI_GE: r = (c == 1 || c == 0); break;
+        case LBI_LE: r = (c == -1 || c == 0); break;
+    }
     lval_del(a);
     return lval_num(r);
 }
 
 /* equal or not equal? */
-lval* builtin_cmp(lenv* e, lval* a, char* op) {
-    LASSERT_NUM(op, a, 2);
-    int r;
-    if (strcmp(op, "==") == 0) { r =  lval_eq(a->cell[0], a->cell[1]); }
-    if (strcmp(op, "!=") == 0) { r = !lval_eq(a->cell[0], a->cell[1]); }
+lval* builtin_cmp(lenv* e, lval* a, int op) {
+    LASSERT_NUM(lbi_names[op], a, 2);
+    int r = lval_eq(a->cell[0], a->cell[1]);
+    if (op == LBI_NE) { r = !r; }
     lval_del(a);
     return lval_num(r);
 }
 
 /* if */
-/* cell[0] is the check, cell[1,2] are expressions to eval on true/false */
-lval* builtin_if(lenv* e, lval* a) {
+/* cell[0] is the check, cell[1,2] are expressions to eval on true/false.
+ * returns the sexpr builtin_if would evaluate, or an error */
+lval* builtin_if_tail(lval* a) {
     LASSERT_NUM("if", a, 3);
     LASSERT_TYPE("if", a, 0, LVAL_NUM);
     LASSERT_TYPE("if", a, 1, LVAL_QEXPR);
     LASSERT_TYPE("if", a, 2, LVAL_QEXPR);
 
-    /* make the q-exprs into s-exprs, but don't eval yet */
-    lval* x;
-    a->cell[1]->type = LVAL_SEXPR;
-    a->cell[2]->type = LVAL_SEXPR;
-
-    if (a->cell[0]->num) {
-        x = lval_eval(e, lval_pop(a, 1));
-    } else {
-        x = lval_eval(e, lval_pop(a, 2));
-    }
+    /* pick a branch and make it into an sexpr to eval */
+    lval* x = lval_own(lval_pop(a, a->cell[0]->num ? 1 : 2));
+    x->type = LVAL_SEXPR;
 
     lval_del(a);
     return x;
 }
 
+lval* builtin_if(lenv* e, lval* a) {
+    lval* x = builtin_if_tail(a);
+    return x->type == LVAL_ERR ? x : lval_eval(e, x);
+}
+
+int lvm_enabled;
+void lcode_for(lval* f);
+
 /* anonymous functions */
 lval* builtin_lambda(lenv* e, lval* a) {
     /* check we received two arguments */
@@ -702,7 +2148,9 @@ lval* builtin_lambda(lenv* e, lval* a) {
     lval* body = lval_pop(a, 0);
     lval_del(a);
 
-    return lval_lambda(formals, body);
+    lval* f = lval_lambda(formals, body);
+    if (lvm_enabled) { lcode_for(f); }
+    return f;
 }
 
 lval* builtin_head(lenv* e, lval* a) {
@@ -711,14 +2159,12 @@ lval* builtin_head(lenv* e, lval* a) {
     LASSERT_TYPE("head", a, 0, LVAL_QEXPR);
     LASSERT(a, (a->cell[0]->count != 0), "'head' passed {}!");
 
-    /* otherwise take first and delete the rest */
+    /* otherwise take first and let the rest go. it goes in a list of
+     * its own so it doesn't keep a shared block alive */
     lval* v = lval_take(a, 0);
-
-    /* is this loop needed? Don't we already do this with lval_take? */
-    while(v->count > 1) {
-        lval_del(lval_pop(v, 1));
-    }
-    return v;
+    lval* x = lval_add(lval_qexpr(), lval_ref(v->cell[0]));
+    lval_del(v);
+    return x;
 }
 
 lval* builtin_tail(lenv* e, lval* a) {
@@ -727,13 +2173,8 @@ lval* builtin_tail(lenv* e, lval* a) {
     LASSERT_TYPE("tail", a, 0, LVAL_QEXPR);
     LASSERT(a, (a->cell[0]->count != 0), "'tail' passed {}!");
 
-    /* take the first */
-    lval* v = lval_take(a, 0);
-
-    /* and delete the rest of it */
-    lval_del(lval_pop(v, 0));
-
-    return v;
+    /* take the list and drop its first item */
+    return lval_slice(lval_take(a, 0), 1);
 }
 
 lval* builtin_list(lenv* e, lval* a) {
@@ -742,22 +2183,30 @@ lval* builtin_list(lenv* e, lval* a) {
     return a;
 }
 
-lval* builtin_eval(lenv* e, lval* a) {
+/* returns the sexpr builtin_eval would evaluate, or an error */
+lval* builtin_eval_tail(lval* a) {
     LASSERT_NUM("eval", a, 1);
     LASSERT_TYPE("eval", a, 0, LVAL_QEXPR);
 
-    /* make it into an sexpr and evaluate it! */
-    lval* x = lval_take(a, 0);
+    /* make it into an sexpr... */
+    lval* x = lval_own(lval_take(a, 0));
     x->type = LVAL_SEXPR;
-    return lval_eval(e, x);
+    return x;
+}
+
+lval* builtin_eval(lenv* e, lval* a) {
+    /* ...and evaluate it! */
+    lval* x = builtin_eval_tail(a);
+    return x->type == LVAL_ERR ? x : lval_eval(e, x);
 }
 
 lval* builtin_join(lenv* e, lval* a) {
+    LASSERT(a, a->count > 0, "Function join passed no arguments!");
     for (int i = 0; i < a->count; i++) {
         LASSERT_TYPE("join", a, i, LVAL_QEXPR);
     }
 
-    lval* x = lval_pop(a, 0);
+    lval* x = lval_own(lval_pop(a, 0));
 
     while(a->count) {
         x = lval_join(x, lval_pop(a, 0));
@@ -771,16 +2220,22 @@ lval* builtin_cons(lenv* e, lval* a) {
     LASSERT_NUM("cons", a, 2);
     LASSERT_TYPE("cons", a, 1, LVAL_QEXPR);
 
+    lval* x = lval_pop(a, 0);
+    if (lcells_shared) { return lval_cons(x, lval_take(a, 0)); }
+
     /* get the first item from the input
      * coerce it to be a qexpr
      * then join the new qexpr to the existing list */
-    lval* z = lval_join(lval_add(lval_qexpr(), lval_pop(a, 0)), lval_take(a, 0));
+    x = lval_add(lval_qexpr(), x);
+    lval* z = lval_join(x, lval_take(a, 0));
 
     /* return a pointer to the new lval */
     return z;
 }
 
-lval* builtin_var(lenv* e, lval* a, char* func) {
+lval* builtin_var(lenv* e, lval* a, int op) {
+    char* func = lbi_names[op];
+    LASSERT(a, a->count > 0, "Function %s passed no arguments!", func);
     LASSERT_TYPE(func, a, 0, LVAL_QEXPR);
 
     lval* syms = a->cell[0];
@@ -796,11 +2251,18 @@ lval* builtin_var(lenv* e, lval* a, char* func) {
         func, syms->count, a->count-1);
 
     for (int i = 0; i < syms->count; ++i) {
+        /* a lambda is known by the first name it's given, for profiling;
+         * if it's shared, the name goes on a copy of its own */
+        lval* v = a->cell[i+1];
+        if (v->type == LVAL_FUN && !v->builtin && !v->env->name) {
+            v = a->cell[i+1] = lval_own(v);
+            v->env->name = syms->cell[i]->sym;
+        }
+
         /* def is global, put/= is local */
-        if (strcmp(func, "def") == 0) {
+        if (op == LBI_DEF) {
             lenv_def(e, syms->cell[i], a->cell[i+1]);
-        }
-        if (strcmp(func, "put") == 0) {
+        } else {
             lenv_put(e, syms->cell[i], a->cell[i+1]);
         }
     }
@@ -811,111 +2273,2777 @@ lval* builtin_var(lenv* e, lval* a, char* func) {
 
 lval* lval_read(mpc_ast_t* t);
 
-lval* builtin_load(lenv* e, lval* a) {
-    LASSERT_NUM("load", a, 1);
-    LASSERT_TYPE("load", a, 0, LVAL_STR);
-
-    mpc_result_t r;
-    if (mpc_parse_contents(a->cell[0]->str, Expr, &r)) {
-        /* read it */
-        lval* expr = lval_read(r.output);
-        mpc_ast_delete(r.output);
-
-        while(expr->count) {
-            lval* x = lval_eval(e, lval_pop(expr, 0));
-            /* error check! */
-            if (x->type == LVAL_ERR) { lval_println(x); }
-            lval_del(x);
-        }
+/*
+ * profiling
+ *
+ * with --profile, or after (profile-start), the calls made on the main
+ * thread are tracked in a tree of the call paths taken, each node
+ * counting its calls and the time spent with it on top of the stack.
+ * the clock is read whenever the path changes, as a call starts or
+ * returns, so time is charged as it's spent rather than sampled. a
+ * tail call takes the place of its caller, as it does on the C stack.
+ * lambdas go by the name they were first def'd as (see builtin_var),
+ * builtins by the name they were added under.
+ */
 
-        lval_del(expr);
-        lval_del(a);
+struct lprof {
+    /* what was called; a lambda that was never def'd has neither */
+    latom* name;
+    lbuiltin builtin;
+    long calls;
+    /* seconds spent with this path on top of the stack */
+    double self;
+    lprof* par;
+    /* the calls made from here, and the next of our parent's */
+    lprof* kids;
+    lprof* next;
+};
 
-        return lval_sexpr();
-    } else {
-        /* parse error */
-        char* err_msg = mpc_err_string(r.error);
-        mpc_err_delete(r.error);
+/* where the main thread is in the tree, or NULL when not profiling.
+ * nodes last until exit, so the paths calls were entered from are still
+ * good to return to after profiling is stopped and started again */
+__thread lprof* lprof_at = NULL;
+lprof lprof_root;
+/* when the path we're on was last charged for */
+double lprof_since;
+
+/* set by --profile, and by --profile-folded to where the stacks go */
+int lprof_exit = 0;
+char* lprof_folded = NULL;
+
+latom* lbuiltin_name(lbuiltin func);
+
+/* charge the path we're on for the time since it last was */
+void lprof_charge(void) {
+    double now = lclock();
+    lprof_at->self += now - lprof_since;
+    lprof_since = now;
+}
 
-        lval* err = lval_err("Could not load library; %s", err_msg);
-        free(err_msg);
-        lval_del(a);
-        return err;
+/* the path is now p, then a call of the given function */
+void lprof_call(lprof* p, latom* name, lbuiltin builtin) {
+    if (!lprof_at) { return; }
+    lprof_charge();
+
+    lprof* k = p->kids;
+    while (k && (k->name != name || k->builtin != builtin)) { k = k->next; }
+    if (!k) {
+        k = calloc(1, sizeof(lprof));
+        k->name = name;
+        k->builtin = builtin;
+        k->par = p;
+        k->next = p->kids;
+        p->kids = k;
     }
+    k->calls++;
+    lprof_at = k;
 }
 
-lval* builtin_print(lenv* e, lval* a) {
+/* the call made from p has returned */
+void lprof_return(lprof* p) {
+    if (!lprof_at) { return; }
+    lprof_charge();
+    lprof_at = p;
+}
 
-    /* Print each argument followed by a space */
-    for (int i = 0; i < a->count; i++) {
-        lval_print(a->cell[i]); putchar(' ');
+void lprof_clear(lprof* p) {
+    p->calls = 0;
+    p->self = 0;
+    for (lprof* k = p->kids; k; k = k->next) { lprof_clear(k); }
+}
+
+void lprof_free(lprof* p) {
+    while (p->kids) {
+        lprof* k = p->kids;
+        p->kids = k->next;
+        lprof_free(k);
+        free(k);
     }
+}
 
-    /* Print a newline and delete arguments */
-    putchar('\n');
-    lval_del(a);
+/* start afresh from the top of the tree */
+void lprof_start(void) {
+    lprof_clear(&lprof_root);
+    lprof_at = &lprof_root;
+    lprof_since = lclock();
+}
 
-    return lval_sexpr();
+void lprof_stop(void) {
+    if (lprof_at) { lprof_charge(); }
+    lprof_at = NULL;
 }
 
-lval* builtin_error(lenv* e, lval* a) {
-    LASSERT_NUM("error", a, 1);
-    LASSERT_TYPE("error", a, 0, LVAL_STR);
+char* lprof_name(lprof* p) {
+    if (p->builtin) {
+        latom* name = lbuiltin_name(p->builtin);
+        return name ? name->name : "<builtin>";
+    }
+    return p->name ? p->name->name : "lambda";
+}
 
-    /* Construct Error from first argument */
-    lval* err = lval_err(a->cell[0]->str);
+/* one function's share of the tree, for the flat profile */
+typedef struct lprof_line {
+    lprof* first;
+    long calls;
+    double self;
+    double total;
+    /* how many times it's on the path being walked */
+    int open;
+} lprof_line;
+
+/* add p and everything under it into the lines, returning the time
+ * spent under p all told. a function that recurses only counts its
+ * outermost call towards its total */
+double lprof_tally(lprof* p, lprof_line** lines, int* count) {
+    int i = 0;
+    while (i < *count && ((*lines)[i].first->name != p->name ||
+                          (*lines)[i].first->builtin != p->builtin)) { i++; }
+    if (i == *count) {
+        *lines = realloc(*lines, sizeof(lprof_line) * (*count + 1));
+        (*lines)[i] = (lprof_line){ p, 0, 0, 0, 0 };
+        (*count)++;
+    }
+    (*lines)[i].calls += p->calls;
+    (*lines)[i].self += p->self;
+    (*lines)[i].open++;
 
-    /* Delete arguments and return */
-    lval_del(a);
-    return err;
+    double total = p->self;
+    for (lprof* k = p->kids; k; k = k->next) {
+        total += lprof_tally(k, lines, count);
+    }
+
+    if (--(*lines)[i].open == 0) { (*lines)[i].total += total; }
+    return total;
 }
 
-lval* builtin_def(lenv* e, lval* a) {
-    return builtin_var(e, a, "def");
+int lprof_line_cmp(const void* a, const void* b) {
+    double x = ((lprof_line*)a)->self;
+    double y = ((lprof_line*)b)->self;
+    return (x < y) - (x > y);
 }
 
-lval* builtin_put(lenv* e, lval* a) {
-    return builtin_var(e, a, "=");
+/* the flat profile, busiest first, on stderr */
+void lprof_print(void) {
+    lprof_line* lines = NULL;
+    int count = 0;
+    double all = lprof_root.self;
+    for (lprof* k = lprof_root.kids; k; k = k->next) {
+        all += lprof_tally(k, &lines, &count);
+    }
+    qsort(lines, count, sizeof(lprof_line), lprof_line_cmp);
+
+    fprintf(stderr, "profile: %.3fs, %.3fs of it outside any call\n",
+        all, lprof_root.self);
+    fprintf(stderr, "%17s %17s %11s  %s\n", "self", "total", "calls", "function");
+    for (int i = 0; i < count; i++) {
+        lprof_line* l = &lines[i];
+        if (!l->calls && l->total == 0) { continue; }
+        fprintf(stderr, "%9.3fs %5.1f%% %9.3fs %5.1f%% %11li  %s\n",
+            l->self, all > 0 ? 100 * l->self / all : 0.0,
+            l->total, all > 0 ? 100 * l->total / all : 0.0,
+            l->calls, lprof_name(l->first));
+    }
+    free(lines);
 }
 
-lval* builtin_add(lenv* e, lval* a) {
-    return builtin_op(e, a, "+");
+/* a line for each path that was called: the names along it separated
+ * by ';', then the microseconds it spent on top, as flamegraph.pl and
+ * friends take them. paths too quick to register still get a line (of
+ * 0), so which lines there are doesn't depend on the timings */
+void lprof_fold(lprof* p, lbuf* path, FILE* f) {
+    long len = path->len;
+    if (len) { lbuf_char(path, ';'); }
+    lbuf_str(path, lprof_name(p));
+
+    long us = p->self * 1e6;
+    if (p->calls) {
+        fwrite(path->data, 1, path->len, f);
+        fprintf(f, " %li\n", us);
+    }
+    for (lprof* k = p->kids; k; k = k->next) { lprof_fold(k, path, f); }
+    path->len = len;
+}
+
+lval* lprof_write(char* file) {
+    FILE* f = fopen(file, "w");
+    if (!f) { return lval_err("Cannot write profile; %s: %s", file, strerror(errno)); }
+
+    lbuf path = { NULL, 0, 0, NULL };
+    for (lprof* k = lprof_root.kids; k; k = k->next) { lprof_fold(k, &path, f); }
+    free(path.data);
+
+    if (fclose(f) != 0) {
+        return lval_err("Cannot write profile; %s: %s", file, strerror(errno));
+    }
+    return NULL;
+}
+
+/*
+ * the reader
+ *
+ * turns source text straight into lvals, one top-level form at a time,
+ * without building an mpc AST first. files are mapped and read in
+ * place; other streams are read in chunks. either way only as far as
+ * the form being read, so programs run as they load.
+ * the mpc grammar in main is still there for --mpc-reader, which parses
+ * everything up front the old way, to compare against.
+ */
+
+/* set by --mpc-reader */
+int lreader_mpc = 0;
+
+/* how much of a stream to read at a time */
+#define LREADER_CHUNK 65536
+
+/* how much of a mapping to read before unmapping what's been read */
+#define LREADER_RELEASE (LREADER_CHUNK * 64)
+
+typedef struct lreader {
+    char* name;
+    /* refilled from, if there is one; otherwise buf is all there is */
+    FILE* f;
+    /* buf is this file mapping, if it's one, and how much of it is gone */
+    char* map;
+    long unmapped;
+    char* buf;
+    long len;
+    long pos;
+    long cap;
+    /* where the token being read started, so a refill keeps it; or -1 */
+    long mark;
+    /* for error messages: the line we're on, and where in buf it began */
+    int line;
+    long bol;
+    /* the lists opened but not yet closed */
+    lval** open;
+    int depth;
+    int opens;
+    /* set once there's been a syntax error */
+    int failed;
+    /* everything mpc read, in --mpc-reader mode */
+    lval* forms;
+    /* forms read so far, when we started, and seconds spent reading
+     * (which with mpc is all up front) */
+    long count;
+    double start;
+    double time;
+} lreader;
+
+/* the mpc grammar, only built for --mpc-reader */
+void lreader_mpc_init(void) {
+    /* create some parsers */
+    Number  = mpc_new("number");
+    Symbol  = mpc_new("symbol");
+    Sexpr   = mpc_new("sexpr");
+    String  = mpc_new("string");
+    Comment = mpc_new("comment");
+    Qexpr   = mpc_new("qexpr");
+    Expr    = mpc_new("expr");
+    Program = mpc_new("program");
+
+    /* Define them with this language */
+    mpca_lang(MPC_LANG_DEFAULT,
+    "   number  : /-?[0-9]+(\\.[0-9]+)?([eE][-+]?[0-9]+)?/ ; \
+        symbol  : /[a-zA-Z0-9_+\\-*\\/\\\\=<>!&\\.]+/ ; \
+        sexpr   : '(' <expr>* ')' | <number> ;          \
+        qexpr   : '{' <expr>* '}' ;                     \
+        string  : /\"(\\\\.|[^\"])*\"/ ;                \
+        comment : /;[^\\r\\n]*/ ;                       \
+        expr    : <number> | <symbol>  | <sexpr>        \
+                | <qexpr>  | <comment> | <string> ;     \
+        program : /^/ <expr>* /$/ ;                     ",
+    Number, Symbol, Sexpr, Qexpr, String, Comment, Expr, Program);
+}
+
+/* read forms from s, which must outlive r */
+void lreader_string(lreader* r, char* name, char* s) {
+    memset(r, 0, sizeof(lreader));
+    r->name = name;
+    r->buf = s;
+    r->len = strlen(s);
+    r->mark = -1;
+    r->line = 1;
+
+    if (lreader_mpc) {
+        mpc_result_t res;
+        if (mpc_parse(name, s, Program, &res)) {
+            r->forms = lval_read(res.output);
+            mpc_ast_delete(res.output);
+        } else {
+            char* err_msg = mpc_err_string(res.error);
+            mpc_err_delete(res.error);
+            r->forms = lval_add(lval_sexpr(), lval_err("%s", err_msg));
+            free(err_msg);
+        }
+    }
+}
+
+/* read forms from the file at path ("-" for stdin). returns an error if
+ * it can't be opened */
+lval* lreader_open(lreader* r, char* path) {
+    int in = strcmp(path, "-") == 0;
+    memset(r, 0, sizeof(lreader));
+    r->name = in ? "<stdin>" : path;
+    r->mark = -1;
+    r->line = 1;
+    r->start = lclock();
+
+    if (lreader_mpc) {
+        mpc_result_t res;
+        int ok = in
+            ? mpc_parse_pipe(r->name, stdin, Program, &res)
+            : mpc_parse_contents(path, Program, &res);
+
+        if (!ok) {
+            /* parse error */
+            char* err_msg = mpc_err_string(res.error);
+            mpc_err_delete(res.error);
+
+            lval* err = lval_err("Could not load library; %s", err_msg);
+            free(err_msg);
+            return err;
+        }
+        r->forms = lval_read(res.output);
+        mpc_ast_delete(res.output);
+        r->time = lclock() - r->start;
+        return NULL;
+    }
+
+    /* map regular files, so they're read without copying them at all */
+    int fd = in ? -1 : open(path, O_RDONLY);
+    struct stat st;
+    if (fd >= 0 && fstat(fd, &st) != 0) { st.st_mode = 0; }
+    if (fd >= 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        void* m = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (m != MAP_FAILED) {
+            close(fd);
+            r->map = r->buf = m;
+            r->len = st.st_size;
+            return NULL;
+        }
+    }
+
+    if (fd >= 0 && S_ISDIR(st.st_mode)) {
+        close(fd);
+        fd = -1;
+        errno = EISDIR;
+    }
+    r->f = in ? stdin : fd >= 0 ? fdopen(fd, "rb") : NULL;
+    if (!r->f) {
+        lval* err = lval_err("Could not load library; %s: %s", path, strerror(errno));
+        if (fd >= 0) { close(fd); }
+        return err;
+    }
+    r->cap = LREADER_CHUNK;
+    r->buf = malloc(r->cap);
+    return NULL;
+}
+
+void lreader_close(lreader* r) {
+    for (int i = 0; i < r->depth; i++) { lval_del(r->open[i]); }
+    free(r->open);
+    if (r->forms) { lval_del(r->forms); }
+    if (r->map && r->len > r->unmapped) {
+        munmap(r->map + r->unmapped, r->len - r->unmapped);
+    }
+    if (r->f) {
+        free(r->buf);
+        if (r->f != stdin) { fclose(r->f); }
+    }
+}
+
+/* read more of the stream, keeping any token in progress. returns 0 once
+ * there's no more */
+int lreader_fill(lreader* r) {
+    if (!r->f) { return 0; }
+
+    long keep = r->mark >= 0 ? r->mark : r->pos;
+    memmove(r->buf, r->buf + keep, r->len - keep);
+    r->len -= keep;
+    r->pos -= keep;
+    r->bol -= keep;
+    if (r->mark >= 0) { r->mark = 0; }
+
+    /* a token longer than the buffer */
+    if (r->cap - r->len < LREADER_CHUNK / 2) {
+        r->cap *= 2;
+        r->buf = realloc(r->buf, r->cap);
+    }
+
+    size_t n = fread(r->buf + r->len, 1, r->cap - r->len, r->f);
+    r->len += n;
+    return n > 0;
+}
+
+/* nothing before pos is looked at again, as everything read is copied
+ * out, so hand the pages back; otherwise a big file would end up in
+ * memory in its entirety */
+void lreader_release(lreader* r) {
+    long page = sysconf(_SC_PAGESIZE);
+    long upto = r->pos / page * page;
+    munmap(r->map + r->unmapped, upto - r->unmapped);
+    r->unmapped = upto;
+}
+
+/* the next char, without taking it, or EOF */
+int lreader_peek(lreader* r) {
+    if (r->pos == r->len && !lreader_fill(r)) { return EOF; }
+    return (unsigned char)r->buf[r->pos];
+}
+
+/* what the symbol and number rules are made of */
+int lreader_symchar(int c) {
+    if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z')) { return 1; }
+    if (c >= '0' && c <= '9') { return 1; }
+    switch (c) {
+        case '_': case '+': case '-': case '*': case '/': case '\\':
+        case '=': case '<': case '>': case '!': case '&': case '.':
+            return 1;
+    }
+    return 0;
+}
+
+/* skip whitespace and comments, returning the char after them */
+int lreader_space(lreader* r) {
+    while (1) {
+        int c = lreader_peek(r);
+        if (c == '\n') {
+            r->line++;
+            r->bol = ++r->pos;
+        } else if (c == ' ' || c == '\t' || c == '\r' || c == '\f' || c == '\v') {
+            r->pos++;
+        } else if (c == ';') {
+            while ((c = lreader_peek(r)) != EOF && c != '\n' && c != '\r') {
+                r->pos++;
+            }
+        } else {
+            return c;
+        }
+    }
+}
+
+/* give up on the form being read */
+lval* lreader_error(lreader* r, char* what, int c) {
+    for (int i = 0; i < r->depth; i++) { lval_del(r->open[i]); }
+    r->depth = 0;
+    r->mark = -1;
+    return c == EOF
+        ? lval_err("%s:%i:%li: error: %s", r->name, r->line, r->pos - r->bol + 1, what)
+        : lval_err("%s:%i:%li: error: %s '%c'", r->name, r->line, r->pos - r->bol + 1, what, c);
+}
+
+/* the n chars at s make a number if they match the number rule,
+ * -?[0-9]+(\.[0-9]+)?([eE][-+]?[0-9]+)?  returns 0 if they don't, 1 for
+ * an integer and 2 for a double */
+int lreader_numeric(char* s, long n) {
+    long i = 0;
+    int kind = 1;
+    if (s[i] == '-') { i++; }
+    if (i == n || s[i] < '0' || s[i] > '9') { return 0; }
+    while (i < n && s[i] >= '0' && s[i] <= '9') { i++; }
+
+    if (i < n && s[i] == '.') {
+        if (++i == n || s[i] < '0' || s[i] > '9') { return 0; }
+        while (i < n && s[i] >= '0' && s[i] <= '9') { i++; }
+        kind = 2;
+    }
+    if (i < n && (s[i] == 'e' || s[i] == 'E')) {
+        if (++i < n && (s[i] == '-' || s[i] == '+')) { i++; }
+        if (i == n || s[i] < '0' || s[i] > '9') { return 0; }
+        while (i < n && s[i] >= '0' && s[i] <= '9') { i++; }
+        kind = 2;
+    }
+    return i == n ? kind : 0;
+}
+
+/* a number or symbol. these end wherever the symbol rule stops matching,
+ * so unlike with mpc "1a" is a single symbol, not 1 then a */
+lval* lreader_atom(lreader* r) {
+    r->mark = r->pos;
+    while (lreader_peek(r) != EOF && lreader_symchar(r->buf[r->pos])) {
+        r->pos++;
+    }
+    char* s = r->buf + r->mark;
+    long n = r->pos - r->mark;
+    r->mark = -1;
+
+    int kind = lreader_numeric(s, n);
+    if (kind == 0) {
+        lval* v = lval_alloc(LVAL_SYM);
+        v->sym = latom_intern_len(s, n);
+        return v;
+    }
+
+    /* up to 18 digits always fit in a long */
+    if (kind == 1 && n - (s[0] == '-') <= 18) {
+        long x = 0;
+        for (long i = s[0] == '-'; i < n; i++) { x = x * 10 + (s[i] - '0'); }
+        return lval_num(s[0] == '-' ? -x : x);
+    }
+
+    /* otherwise do what lval_read_num does, on a terminated copy */
+    char small[64];
+    char* t = n < 64 ? small : malloc(n + 1);
+    memcpy(t, s, n);
+    t[n] = '\0';
+
+    lval* v;
+    errno = 0;
+    if (kind == 2) {
+        double x = strtod(t, NULL);
+        v = errno != ERANGE ? lval_dbl(x) : lval_err("invalid number");
+    } else {
+        long x = strtol(t, NULL, 10);
+        v = errno != ERANGE ? lval_num(x) : lval_big(lbig_read(t));
+    }
+    if (t != small) { free(t); }
+    return v;
+}
+
+/* a string, from the opening quote; NULL if it never ends */
+lval* lreader_str(lreader* r) {
+    r->mark = r->pos++;
+    int lines = 0;
+    long bol = 0;
+    while (1) {
+        int c = lreader_peek(r);
+        if (c == EOF) { return NULL; }
+        r->pos++;
+        if (c == '"') { break; }
+        if (c == '\\') {
+            if (lreader_peek(r) == EOF) { return NULL; }
+            c = r->buf[r->pos++];
+        }
+        if (c == '\n') { lines++; bol = r->pos - r->mark; }
+    }
+
+    /* size it, then write it straight into the new string. strings are
+     * kept escaped, as lval_read_string keeps them */
+    char* s = r->buf + r->mark + 1;
+    long n = r->pos - r->mark - 2;
+    long size = n;
+    for (long i = 0; i < n; i++) {
+        char* esc = lchar_escape(s[i]);
+        if (esc) { size += strlen(esc) - 1; }
+    }
+
+    lval* v = lval_alloc(LVAL_STR);
+    v->str = malloc(size + 1);
+    char* out = v->str;
+    for (long i = 0; i < n; i++) {
+        char* esc = lchar_escape(s[i]);
+        if (esc) {
+            while (*esc) { *out++ = *esc++; }
+        } else {
+            *out++ = s[i];
+        }
+    }
+    *out = '\0';
+
+    if (lines) {
+        r->line += lines;
+        r->bol = r->mark + bol;
+    }
+    r->mark = -1;
+    return v;
+}
+
+/* the next top-level form, NULL at the end, or an error if the source
+ * doesn't parse. an error ends the source: what follows is unreadable */
+lval* lreader_next(lreader* r) {
+    if (r->failed) { return NULL; }
+    if (r->forms) {
+        if (r->forms->count == 0) { return NULL; }
+        r->count++;
+        return lval_pop(r->forms, 0);
+    }
+
+    double start = lclock();
+    lval* x;
+    while (1) {
+        if (r->map && r->pos - r->unmapped >= LREADER_RELEASE) {
+            lreader_release(r);
+        }
+
+        int c = lreader_space(r);
+
+        if (c == EOF) {
+            if (r->depth == 0) {
+                r->time += lclock() - start;
+                return NULL;
+            }
+            x = lreader_error(r, "unexpected end of input", EOF);
+            break;
+        }
+
+        if (c == '(' || c == '{') {
+            if (r->depth == r->opens) {
+                r->opens = r->opens ? r->opens * 2 : 16;
+                r->open = realloc(r->open, sizeof(lval*) * r->opens);
+            }
+            r->open[r->depth++] = c == '(' ? lval_sexpr() : lval_qexpr();
+            r->pos++;
+            continue;
+        }
+
+        if (c == ')' || c == '}') {
+            int want = r->depth == 0 ? 0
+                : r->open[r->depth-1]->type == LVAL_SEXPR ? ')' : '}';
+            if (c != want) {
+                x = lreader_error(r, "unexpected", c);
+                break;
+            }
+            r->pos++;
+            x = r->open[--r->depth];
+        } else if (c == '"') {
+            x = lreader_str(r);
+            if (!x) {
+                r->pos = r->mark;
+                x = lreader_error(r, "unterminated string", EOF);
+                break;
+            }
+        } else if (lreader_symchar(c)) {
+            x = lreader_atom(r);
+        } else {
+            x = lreader_error(r, "unexpected", c);
+            break;
+        }
+
+        if (r->depth == 0) { break; }
+        lval_add(r->open[r->depth-1], x);
+    }
+
+    /* nothing more is read after an error */
+    if (x->type == LVAL_ERR) { r->failed = 1; }
+    r->count++;
+    r->time += lclock() - start;
+    return x;
+}
+
+/* set by --time */
+int lrun_timing = 0;
+
+/* seconds spent on everything besides reading, since r was opened */
+double lreader_eval_time(lreader* r) {
+    return lclock() - r->start - r->time;
+}
+
+/* the --time line for some source that's been run */
+void lrun_report(char* name, long forms, double parse, double eval) {
+    struct rusage u;
+    getrusage(RUSAGE_SELF, &u);
+    long rss = u.ru_maxrss;
+#ifdef __APPLE__
+    /* macOS gives it in bytes, Linux in KB */
+    rss /= 1024;
+#endif
+    fprintf(stderr, "%s: %li forms, parsed in %.3fs, evaluated in %.3fs (%.1f forms/s), peak RSS %liKB\n",
+        name, forms, parse, eval, eval > 0 ? forms / eval : 0.0, rss);
+}
+
+/* evaluate the forms r reads in turn, printing any errors, and return how
+ * many errors there were. at the top level (rather than in a load)
+ * between forms is a safe point for the collector */
+int lval_run(lenv* e, lreader* r, int top) {
+    int errors = 0;
+    lval* x;
+    while ((x = lreader_next(r))) {
+        lval* v = lval_eval(e, x);
+        /* error check! */
+        if (v->type == LVAL_ERR) {
+            lval_println(v);
+            errors++;
+        }
+        lval_del(v);
+        if (top) { gc_maybe_collect(e, r->forms); }
+    }
+    return errors;
+}
+
+lval* builtin_load(lenv* e, lval* a) {
+    LASSERT_NUM("load", a, 1);
+    LASSERT_TYPE("load", a, 0, LVAL_STR);
+
+    lreader r;
+    lval* err = lreader_open(&r, a->cell[0]->str);
+    if (err) {
+        lval_del(a);
+        return err;
+    }
+
+    lval_run(e, &r, 0);
+    if (lrun_timing) { lrun_report(r.name, r.count, r.time, lreader_eval_time(&r)); }
+    lreader_close(&r);
+    lval_del(a);
+    return lval_sexpr();
+}
+
+lval* builtin_print(lenv* e, lval* a) {
+    lbuf b = { NULL, 0, 0, stdout };
+
+    /* Print each argument followed by a space */
+    for (int i = 0; i < a->count; i++) {
+        lval_write(&b, a->cell[i]); lbuf_char(&b, ' ');
+    }
+
+    /* Print a newline, all in one go, and delete arguments */
+    lbuf_char(&b, '\n');
+    lbuf_flush(&b);
+    free(b.data);
+    lval_del(a);
+
+    return lval_sexpr();
+}
+
+/* (to-string x ...) is what print would show for its arguments, with a
+ * space between each but nothing at the end */
+lval* builtin_to_string(lenv* e, lval* a) {
+    lbuf b = { NULL, 0, 0, NULL };
+    for (int i = 0; i < a->count; i++) {
+        if (i) { lbuf_char(&b, ' '); }
+        lval_write(&b, a->cell[i]);
+    }
+    lbuf_char(&b, '\0');
+    lval_del(a);
+
+    lval* v = lval_alloc(LVAL_STR);
+    v->str = realloc(b.data, b.len);
+    return v;
+}
+
+lval* builtin_allocs(lenv* e, lval* a) {
+    LASSERT_NUM("allocs", a, 0);
+
+    lpool_print(&lval_pool);
+    lpool_print(&lenv_pool);
+
+    lval_del(a);
+    return lval_sexpr();
+}
+
+/* (profile-start) profiles everything from here on, afresh */
+lval* builtin_profile_start(lenv* e, lval* a) {
+    LASSERT_NUM("profile-start", a, 0);
+    LASSERT(a, !lpar_worker, "Function profile-start can only be used on the main thread");
+    lprof_start();
+    lval_del(a);
+    return lval_sexpr();
+}
+
+/* (profile-report) stops profiling and prints the flat profile, or with
+ * a file name writes the folded stacks there instead */
+lval* builtin_profile_report(lenv* e, lval* a) {
+    LASSERT(a, a->count <= 1,
+        "Function profile-report passed too many arguments. Got %i, expected at most 1.",
+        a->count);
+    if (a->count) { LASSERT_TYPE("profile-report", a, 0, LVAL_STR); }
+    LASSERT(a, !lpar_worker, "Function profile-report can only be used on the main thread");
+
+    lprof_stop();
+    lval* err = NULL;
+    if (a->count) {
+        err = lprof_write(a->cell[0]->str);
+    } else {
+        lprof_print();
+    }
+
+    lval_del(a);
+    return err ? err : lval_sexpr();
+}
+
+/* add {name n} to l */
+lval* lstats_add(lval* l, char* name, long n) {
+    lval* x = lval_add(lval_qexpr(), lval_sym(name));
+    return lval_add(l, lval_add(x, lval_num(n)));
+}
+
+/* (stats) is the counters as {name value} pairs; see lstats */
+lval* builtin_stats(lenv* e, lval* a) {
+    LASSERT_NUM("stats", a, 0);
+    lval_del(a);
+
+    lval* l = lval_qexpr();
+    l = lstats_add(l, "evals", lcount.evals);
+    l = lstats_add(l, "builtin-calls", lcount.builtin_calls);
+    l = lstats_add(l, "lambda-calls", lcount.lambda_calls);
+    l = lstats_add(l, "copies", lcount.copies);
+    l = lstats_add(l, "copy-bytes", lcount.copy_bytes);
+    l = lstats_add(l, "lookups", lcount.lookups);
+    l = lstats_add(l, "lookup-frames", lcount.lookup_frames);
+    for (int t = 0; t <= LVAL_FUT; t++) {
+        char name[32];
+        snprintf(name, sizeof(name), "%s-allocs", lstats_types[t]);
+        l = lstats_add(l, name, lcount.allocs[t]);
+        snprintf(name, sizeof(name), "%s-frees", lstats_types[t]);
+        l = lstats_add(l, name, lcount.frees[t]);
+    }
+    l = lstats_add(l, "live", lval_pool.live);
+    l = lstats_add(l, "peak", lval_pool.peak);
+    l = lstats_add(l, "env-live", lenv_pool.live);
+    l = lstats_add(l, "env-peak", lenv_pool.peak);
+    return l;
+}
+
+/* ask for a collection; it happens once we're back at the top level */
+lval* builtin_gc(lenv* e, lval* a) {
+    LASSERT_NUM("gc", a, 0);
+    gc_requested = 1;
+    lval_del(a);
+    return lval_sexpr();
+}
+
+lval* builtin_error(lenv* e, lval* a) {
+    LASSERT_NUM("error", a, 1);
+    LASSERT_TYPE("error", a, 0, LVAL_STR);
+
+    /* Construct Error from first argument */
+    lval* err = lval_err(a->cell[0]->str);
+
+    /* Delete arguments and return */
+    lval_del(a);
+    return err;
+}
+
+lval* builtin_def(lenv* e, lval* a) {
+    return builtin_var(e, a, LBI_DEF);
+}
+
+lval* builtin_put(lenv* e, lval* a) {
+    return builtin_var(e, a, LBI_PUT);
+}
+
+lval* builtin_add(lenv* e, lval* a) {
+    return builtin_op(e, a, LBI_ADD);
 }
 
 lval* builtin_sub(lenv* e, lval* a) {
-    return builtin_op(e, a, "-");
+    return builtin_op(e, a, LBI_SUB);
+}
+
+lval* builtin_mul(lenv* e, lval* a) {
+    return builtin_op(e, a, LBI_MUL);
+}
+
+lval* builtin_div(lenv* e, lval* a) {
+    return builtin_op(e, a, LBI_DIV);
+}
+
+lval* builtin_gt(lenv* e, lval* a) {
+    return builtin_ord(e, a, LBI_GT);
+}
+
+lval* builtin_lt(lenv* e, lval* a) {
+    return builtin_ord(e, a, LBI_LT);
+}
+
+lval* builtin_ge(lenv* e, lval* a) {
+    return builtin_ord(e, a, LBI_GE);
+}
+
+lval* builtin_le(lenv* e, lval* a) {
+    return builtin_ord(e, a, LBI_LE);
+}
+
+lval* builtin_eq(lenv* e, lval* a) {
+    return builtin_cmp(e, a, LBI_EQ);
+}
+
+lval* builtin_ne(lenv* e, lval* a) {
+    return builtin_cmp(e, a, LBI_NE);
+}
+
+/*
+ * vectors
+ *
+ * a vector packs nums or doubles into one flat array, so bulk numeric
+ * work runs over memory like C would rather than through an lval per
+ * number. the kernels are plain loops over restrict pointers, split
+ * into independent accumulators where they reduce, so the compiler can
+ * turn them into SIMD for whatever machine it's building for.
+ */
+
+/* an empty vector of n nums, or of n doubles */
+lval* lval_vec(int n, int dbl) {
+    lval* v = lval_alloc(LVAL_VEC);
+    v->vlen = n;
+    v->vdbl = dbl;
+    v->ivec = dbl ? NULL : malloc(sizeof(long) * (n ? n : 1));
+    v->dvec = dbl ? malloc(sizeof(double) * (n ? n : 1)) : NULL;
+    return v;
+}
+
+double lvec_dsum(const double* restrict x, int n) {
+    double s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        s0 += x[i]; s1 += x[i+1]; s2 += x[i+2]; s3 += x[i+3];
+    }
+    for (; i < n; i++) { s0 += x[i]; }
+    return (s0 + s1) + (s2 + s3);
+}
+
+double lvec_ddot(const double* restrict x, const double* restrict y, int n) {
+    double s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        s0 += x[i] * y[i];     s1 += x[i+1] * y[i+1];
+        s2 += x[i+2] * y[i+2]; s3 += x[i+3] * y[i+3];
+    }
+    for (; i < n; i++) { s0 += x[i] * y[i]; }
+    return (s0 + s1) + (s2 + s3);
+}
+
+/* sums of nums wrap, which is exact whenever the true sum fits; that's
+ * certain if n times the largest magnitude does. the magnitudes are
+ * or-ed together, which bounds the largest from above and keeps the
+ * loop vectorizable */
+unsigned long lvec_isum(const long* restrict x, int n, unsigned long* mag) {
+    unsigned long s = 0, m = 0;
+    for (int i = 0; i < n; i++) {
+        s += (unsigned long)x[i];
+        m |= x[i] < 0 ? -(unsigned long)x[i] : (unsigned long)x[i];
+    }
+    *mag = m;
+    return s;
+}
+
+unsigned long lvec_idot(const long* restrict x, const long* restrict y, int n) {
+    unsigned long s = 0;
+    for (int i = 0; i < n; i++) {
+        s += (unsigned long)x[i] * (unsigned long)y[i];
+    }
+    return s;
+}
+
+unsigned long lvec_imag(const long* restrict x, int n) {
+    unsigned long m = 0;
+    for (int i = 0; i < n; i++) {
+        m |= x[i] < 0 ? -(unsigned long)x[i] : (unsigned long)x[i];
+    }
+    return m;
+}
+
+/* add t to the total, which can be a bignum, dropping t */
+lval* lvec_carry(lval* acc, lval* t) {
+    lval* s = lval_arith(LBI_ADD, acc, t);
+    lval_del(acc); lval_del(t);
+    return s;
+}
+
+/* the careful way, for when the fast one might have overflowed: a long
+ * running sum that's moved into a bignum total whenever it's full */
+lval* lvec_exact(const long* x, const long* y, int n) {
+    lval* acc = lval_num(0);
+    long s = 0;
+    for (int i = 0; i < n; i++) {
+        long t = x[i];
+        if (y && __builtin_mul_overflow(x[i], y[i], &t)) {
+            lval* a = lval_num(x[i]);
+            lval* b = lval_num(y[i]);
+            acc = lvec_carry(acc, lval_arith(LBI_MUL, a, b));
+            lval_del(a); lval_del(b);
+            continue;
+        }
+        long prev = s;
+        if (__builtin_add_overflow(prev, t, &s)) {
+            acc = lvec_carry(acc, lval_num(prev));
+            s = t;
+        }
+    }
+    return lvec_carry(acc, lval_num(s));
+}
+
+/* doubles for v's elements; the caller frees them if they aren't v's own */
+double* lvec_doubles(lval* v) {
+    if (v->vdbl) { return v->dvec; }
+    double* d = malloc(sizeof(double) * (v->vlen ? v->vlen : 1));
+    for (int i = 0; i < v->vlen; i++) { d[i] = v->ivec[i]; }
+    return d;
+}
+
+lval* builtin_vec(lenv* e, lval* a) {
+    LASSERT_NUM("vec", a, 1);
+    LASSERT_TYPE("vec", a, 0, LVAL_QEXPR);
+
+    lval* q = a->cell[0];
+    int dbl = 0;
+    for (int i = 0; i < q->count; i++) {
+        LASSERT(a, q->cell[i]->type == LVAL_NUM || q->cell[i]->type == LVAL_DBL,
+            "Function vec passed bad element %i. Got %s, expected %s or %s.",
+            i, ltype_name(q->cell[i]->type), ltype_name(LVAL_NUM), ltype_name(LVAL_DBL));
+        if (q->cell[i]->type == LVAL_DBL) { dbl = 1; }
+    }
+
+    lval* v = lval_vec(q->count, dbl);
+    for (int i = 0; i < q->count; i++) {
+        if (dbl) {
+            v->dvec[i] = lval_to_double(q->cell[i]);
+        } else {
+            v->ivec[i] = q->cell[i]->num;
+        }
+    }
+    lval_del(a);
+    return v;
+}
+
+/* (vrange n) is the vector 0 1 ... n-1 */
+lval* builtin_vrange(lenv* e, lval* a) {
+    LASSERT_NUM("vrange", a, 1);
+    LASSERT_TYPE("vrange", a, 0, LVAL_NUM);
+    long n = a->cell[0]->num;
+    LASSERT(a, n >= 0 && n <= INT_MAX, "Function vrange passed bad length %li.", n);
+
+    lval* v = lval_vec(n, 0);
+    for (int i = 0; i < n; i++) { v->ivec[i] = i; }
+    lval_del(a);
+    return v;
+}
+
+lval* builtin_vlist(lenv* e, lval* a) {
+    LASSERT_NUM("vlist", a, 1);
+    LASSERT_TYPE("vlist", a, 0, LVAL_VEC);
+
+    lval* v = a->cell[0];
+    lval* q = lval_qexpr();
+    lval_reserve(q, v->vlen);
+    for (int i = 0; i < v->vlen; i++) {
+        q = lval_add(q, v->vdbl ? lval_dbl(v->dvec[i]) : lval_num(v->ivec[i]));
+    }
+    lval_del(a);
+    return q;
+}
+
+lval* builtin_vlen(lenv* e, lval* a) {
+    LASSERT_NUM("vlen", a, 1);
+    LASSERT_TYPE("vlen", a, 0, LVAL_VEC);
+    lval* n = lval_num(a->cell[0]->vlen);
+    lval_del(a);
+    return n;
+}
+
+lval* builtin_vsum(lenv* e, lval* a) {
+    LASSERT_NUM("vsum", a, 1);
+    LASSERT_TYPE("vsum", a, 0, LVAL_VEC);
+
+    lval* v = a->cell[0];
+    lval* r;
+    if (v->vdbl) {
+        r = lval_dbl(lvec_dsum(v->dvec, v->vlen));
+    } else {
+        unsigned long m;
+        unsigned long s = lvec_isum(v->ivec, v->vlen, &m);
+        r = (double)m * v->vlen < 4611686018427387904.0
+            ? lval_num((long)s) : lvec_exact(v->ivec, NULL, v->vlen);
+    }
+    lval_del(a);
+    return r;
+}
+
+lval* builtin_vdot(lenv* e, lval* a) {
+    LASSERT_NUM("vdot", a, 2);
+    LASSERT_TYPE("vdot", a, 0, LVAL_VEC);
+    LASSERT_TYPE("vdot", a, 1, LVAL_VEC);
+
+    lval* x = a->cell[0];
+    lval* y = a->cell[1];
+    LASSERT(a, x->vlen == y->vlen,
+        "Function vdot passed vectors of different lengths. %i vs. %i.",
+        x->vlen, y->vlen);
+
+    lval* r;
+    if (x->vdbl || y->vdbl) {
+        double* dx = lvec_doubles(x);
+        double* dy = lvec_doubles(y);
+        r = lval_dbl(lvec_ddot(dx, dy, x->vlen));
+        if (dx != x->dvec) { free(dx); }
+        if (dy != y->dvec) { free(dy); }
+    } else {
+        /* as for vsum, with the products bounded by the magnitudes */
+        double bound = (double)lvec_imag(x->ivec, x->vlen)
+            * (double)lvec_imag(y->ivec, y->vlen) * x->vlen;
+        r = bound < 4611686018427387904.0
+            ? lval_num((long)lvec_idot(x->ivec, y->ivec, x->vlen))
+            : lvec_exact(x->ivec, y->ivec, x->vlen);
+    }
+    lval_del(a);
+    return r;
+}
+
+/* smallest (max 0) or largest (max 1) element */
+lval* builtin_vext(lenv* e, lval* a, int max) {
+    char* name = max ? "vmax" : "vmin";
+    LASSERT_NUM(name, a, 1);
+    LASSERT_TYPE(name, a, 0, LVAL_VEC);
+    LASSERT(a, a->cell[0]->vlen > 0, "Function %s passed an empty vector!", name);
+
+    lval* v = a->cell[0];
+    int n = v->vlen;
+    lval* r;
+    if (v->vdbl) {
+        const double* restrict x = v->dvec;
+        double m = x[0];
+        if (max) {
+            for (int i = 1; i < n; i++) { m = x[i] > m ? x[i] : m; }
+        } else {
+            for (int i = 1; i < n; i++) { m = x[i] < m ? x[i] : m; }
+        }
+        r = lval_dbl(m);
+    } else {
+        const long* restrict x = v->ivec;
+        long m = x[0];
+        if (max) {
+            for (int i = 1; i < n; i++) { m = x[i] > m ? x[i] : m; }
+        } else {
+            for (int i = 1; i < n; i++) { m = x[i] < m ? x[i] : m; }
+        }
+        r = lval_num(m);
+    }
+    lval_del(a);
+    return r;
+}
+
+lval* builtin_vmin(lenv* e, lval* a) {
+    return builtin_vext(e, a, 0);
+}
+
+lval* builtin_vmax(lenv* e, lval* a) {
+    return builtin_vext(e, a, 1);
+}
+
+/* r = x op y over doubles; y is the scalar s if it's NULL */
+void lvec_dop(int op, double* restrict r, const double* restrict x,
+    const double* restrict y, double s, int n) {
+    switch (op) {
+        case LBI_ADD:
+            if (y) { for (int i = 0; i < n; i++) { r[i] = x[i] + y[i]; } }
+            else   { for (int i = 0; i < n; i++) { r[i] = x[i] + s; } }
+        break;
+        case LBI_SUB:
+            if (y) { for (int i = 0; i < n; i++) { r[i] = x[i] - y[i]; } }
+            else   { for (int i = 0; i < n; i++) { r[i] = x[i] - s; } }
+        break;
+        case LBI_MUL:
+            if (y) { for (int i = 0; i < n; i++) { r[i] = x[i] * y[i]; } }
+            else   { for (int i = 0; i < n; i++) { r[i] = x[i] * s; } }
+        break;
+        case LBI_DIV:
+            if (y) { for (int i = 0; i < n; i++) { r[i] = x[i] / y[i]; } }
+            else   { for (int i = 0; i < n; i++) { r[i] = x[i] / s; } }
+        break;
+    }
+}
+
+/* the same over nums, returning 1 if anything overflowed or 2 if it was
+ * divided by zero. additions and subtractions wrap and check the signs
+ * afterwards, so they still vectorize */
+int lvec_iop(int op, long* restrict r, const long* restrict x,
+    const long* restrict y, long s, int n) {
+    long bad = 0;
+    switch (op) {
+        case LBI_ADD:
+            for (int i = 0; i < n; i++) {
+                long b = y ? y[i] : s;
+                r[i] = (long)((unsigned long)x[i] + (unsigned long)b);
+                bad |= (x[i] ^ r[i]) & (b ^ r[i]);
+            }
+        return bad < 0;
+        case LBI_SUB:
+            for (int i = 0; i < n; i++) {
+                long b = y ? y[i] : s;
+                r[i] = (long)((unsigned long)x[i] - (unsigned long)b);
+                bad |= (x[i] ^ b) & (x[i] ^ r[i]);
+            }
+        return bad < 0;
+        case LBI_MUL:
+            for (int i = 0; i < n; i++) {
+                bad |= __builtin_mul_overflow(x[i], y ? y[i] : s, &r[i]);
+            }
+        return bad != 0;
+        default:
+            for (int i = 0; i < n; i++) {
+                long b = y ? y[i] : s;
+                if (b == 0) { return 2; }
+                if (b == -1 && x[i] == LONG_MIN) { return 1; }
+                r[i] = x[i] / b;
+            }
+        return 0;
+    }
+}
+
+/* (vmap+ v x) and friends: v op x for each element of v, where x is a
+ * number or another vector as long as v */
+lval* builtin_vmap(lenv* e, lval* a, int op) {
+    char name[8];
+    snprintf(name, sizeof(name), "vmap%s", lbi_names[op]);
+    LASSERT_NUM(name, a, 2);
+    LASSERT_TYPE(name, a, 0, LVAL_VEC);
+
+    lval* x = a->cell[0];
+    lval* y = a->cell[1];
+    LASSERT(a, y->type == LVAL_VEC || y->type == LVAL_NUM || y->type == LVAL_DBL,
+        "Function %s passed bad type for arg 1. Got %s, expected %s.",
+        name, ltype_name(y->type), ltype_name(LVAL_VEC));
+    if (y->type == LVAL_VEC) {
+        LASSERT(a, x->vlen == y->vlen,
+            "Function %s passed vectors of different lengths. %i vs. %i.",
+            name, x->vlen, y->vlen);
+    }
+
+    int n = x->vlen;
+    int dbl = x->vdbl || (y->type == LVAL_VEC ? y->vdbl : y->type == LVAL_DBL);
+    lval* r = lval_vec(n, dbl);
+
+    if (dbl) {
+        double* dx = lvec_doubles(x);
+        double* dy = y->type == LVAL_VEC ? lvec_doubles(y) : NULL;
+        double s = dy ? 0 : lval_to_double(y);
+
+        /* dividing by zero is an error here like everywhere else */
+        int zero = 0;
+        if (op == LBI_DIV && dy) {
+            for (int i = 0; i < n; i++) { zero |= dy[i] == 0; }
+        } else if (op == LBI_DIV) {
+            zero = s == 0;
+        }
+
+        if (!zero) { lvec_dop(op, r->dvec, dx, dy, s, n); }
+        if (dx != x->dvec) { free(dx); }
+        if (dy && dy != y->dvec) { free(dy); }
+        if (zero) {
+            lval_del(r); lval_del(a);
+            return lval_err("Division By Zero!");
+        }
+    } else {
+        long* iy = y->type == LVAL_VEC ? y->ivec : NULL;
+        int bad = lvec_iop(op, r->ivec, x->ivec, iy, iy ? 0 : y->num, n);
+        if (bad) {
+            lval_del(r); lval_del(a);
+            return bad == 2 ? lval_err("Division By Zero!")
+                : lval_err("Function %s overflowed a num; use a vector of doubles", name);
+        }
+    }
+
+    lval_del(a);
+    return r;
+}
+
+lval* builtin_vadd(lenv* e, lval* a) {
+    return builtin_vmap(e, a, LBI_ADD);
+}
+
+lval* builtin_vsub(lenv* e, lval* a) {
+    return builtin_vmap(e, a, LBI_SUB);
+}
+
+lval* builtin_vmul(lenv* e, lval* a) {
+    return builtin_vmap(e, a, LBI_MUL);
+}
+
+lval* builtin_vdiv(lenv* e, lval* a) {
+    return builtin_vmap(e, a, LBI_DIV);
+}
+
+/*
+ * parallel evaluation
+ *
+ * spawn hands an expression to a pool of worker threads and gives back
+ * a future for its value, which await waits for. pmap, preduce and pfor
+ * split a list into chunks for the workers the same way. nothing about
+ * an lval is safe to share between threads (reference counts, list
+ * blocks and bytecode are all changed without locks), so each thread
+ * has pools, small numbers and a root env of its own, and values only
+ * cross between threads as copies made with lval_clone:
+ *
+ * - a future takes copies of its expression and of the value of every
+ *   name it could look up when it's spawned, see ltask_capture, and
+ *   runs with those as its globals. its result stays with the thread
+ *   that made it, and each await gets a copy.
+ * - pmap and friends make the main thread wait until they're done, so
+ *   nothing of its can change under a worker, and a worker copies the
+ *   function, the items and any name it looks up (the caller's locals
+ *   too) straight out of it as it needs them, see lpar_import.
+ *
+ * whatever a thread is done with goes back to the thread whose heap
+ * it's in to be freed, see lthread_give. so the functions should be
+ * pure: a def in a worker only lasts as long as the task that did it.
+ *
+ * the workers share out tasks by stealing. a thread puts what it spawns
+ * on a queue of its own and takes back the newest first, and a worker
+ * with nothing left takes the oldest off somebody else's. a worker that
+ * has to wait for a future gets on with its own queue meanwhile; it
+ * doesn't steal, as what it stole might be waiting for what it's in
+ * the middle of.
+ */
+
+/* what a task is for, and where a future is at */
+enum { LTASK_CHUNK, LTASK_FUTURE };
+enum { LTASK_QUEUED, LTASK_DONE };
+
+typedef struct lthread lthread;
+
+/* f called on items, split into nchunks runs of them, in env. results
+ * has one per item, or one per chunk when reducing, and is borrowed from
+ * the chunk's kept list, which goes back to its maker afterwards */
+typedef struct lbatch {
+    int job;
+    lenv* env;
+    lval* f;
+    lval* items;
+    int nchunks;
+    int remaining;
+    lval** results;
+    lval** kept;
+    lthread** makers;
+} lbatch;
+
+struct ltask {
+    int kind;
+    /* futures: every lval pointing at it, plus the queue until it's run */
+    int refs;
+    int state;
+    /* from owner's heap, until the task starts: the expression and the
+     * names it uses, with their values */
+    lthread* owner;
+    lval* expr;
+    lval* syms;
+    lval* vals;
+    /* in maker's heap, once it's done */
+    lthread* maker;
+    lval* result;
+    /* chunks: which one, of what */
+    lbatch* batch;
+    int chunk;
+    /* futures: the others not yet freed, see ltask_futures */
+    ltask* prev;
+    ltask* next;
+};
+
+struct lthread {
+    pthread_mutex_t lock;
+    /* spawned here and not started, oldest at lo */
+    ltask** tasks;
+    int lo, hi, cap;
+    /* values in this thread's heap that others are done with */
+    lval** dead;
+    int ndead, deadcap;
+};
+
+/* what a chunk does */
+enum { LPAR_MAP, LPAR_FOR, LPAR_REDUCE };
+
+/* how many workers to start; 0 for one per processor. see --workers */
+int lpar_workers = 0;
+
+/* main's lthread comes first, then the workers' */
+lthread** lthreads = NULL;
+pthread_t* lpar_threads = NULL;
+int lpar_nthreads = 0;
+__thread lthread* lthread_self = NULL;
+
+/* workers sleep on cond until there are tasks queued, and waiters until
+ * a task is done. queued and active are tasks not yet taken, and taken
+ * but not finished */
+pthread_mutex_t lpar_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t lpar_cond = PTHREAD_COND_INITIALIZER;
+int lpar_queued = 0;
+int lpar_active = 0;
+int lpar_quit = 0;
+
+/* futures that haven't been freed yet. the collector traces what they
+ * hold of its heap, and holds ltask_lock meanwhile so none of them is
+ * started (and hands back what it was spawned with) mid-collection */
+pthread_mutex_t ltask_lock = PTHREAD_MUTEX_INITIALIZER;
+ltask* ltask_futures = NULL;
+
+/* where a worker running a chunk looks up the names it doesn't have */
+__thread lenv* lpar_env = NULL;
+
+lval* lval_apply(lenv* e, lval* v);
+lenv* lenv_clone(lenv* e);
+
+/* a copy of v sharing no storage with it, all of it in the calling
+ * thread's heap (small numbers from its own table), so it can be
+ * handed over to the thread that asked for it */
+lval* lval_clone(lval* v) {
+    switch (v->type) {
+        case LVAL_NUM: return lval_num(v->num);
+
+        case LVAL_SEXPR:
+        case LVAL_QEXPR: {
+            lval* x = v->type == LVAL_SEXPR ? lval_sexpr() : lval_qexpr();
+            if (!v->count) { return x; }
+            lval_reserve(x, v->count);
+            for (int i = 0; i < v->count; i++) {
+                x->cell[x->count++] = lval_clone(v->cell[i]);
+            }
+            x->cells->hi += v->count;
+            return x;
+        }
+
+        case LVAL_FUN: {
+            if (v->builtin) { return lval_fun(v->builtin); }
+            lval* x = lval_alloc(LVAL_FUN);
+            x->builtin = NULL;
+            x->env = lenv_clone(v->env);
+            x->formals = lval_clone(v->formals);
+            x->body = lval_clone(v->body);
+            if (lvm_enabled) { lcode_for(x); }
+            return x;
+        }
+
+        /* everything else copies all it holds anyway, and futures are
+         * meant to be shared */
+        default: return lval_copy(v);
+    }
+}
+
+/* likewise for the env of a function */
+lenv* lenv_clone(lenv* e) {
+    lenv* n = lenv_new();
+    lval* k = lval_alloc(LVAL_SYM);
+    for (int i = 0; i < e->count; i++) {
+        k->sym = e->syms[i];
+        lval* v = lval_clone(e->vals[i]);
+        lenv_put(n, k, v);
+        lval_del(v);
+    }
+    lval_del(k);
+    n->name = e->name;
+    return n;
+}
+
+/* a worker looking up a name none of its frames bind copies it from the
+ * env the chunk it's running was started from, keeping it in its root
+ * in case it's wanted again */
+lval* lpar_import(lval* k) {
+    for (lenv* e = lpar_env; e; e = e->par) {
+        int i = lenv_find(e, k->sym);
+        if (i >= 0) {
+            lval* v = lval_clone(e->vals[i]);
+            lenv_put(lenv_root, k, v);
+            return v;
+        }
+    }
+    return lval_err("Unknown symbol '%s'", k->sym->name);
+}
+
+/* hand v back to the thread whose heap it's in, to free when it can */
+void lthread_give(lthread* to, lval* v) {
+    if (to == lthread_self) {
+        lval_del(v);
+        return;
+    }
+    pthread_mutex_lock(&to->lock);
+    if (to->ndead == to->deadcap) {
+        to->deadcap = to->deadcap ? to->deadcap * 2 : 16;
+        to->dead = realloc(to->dead, sizeof(lval*) * to->deadcap);
+    }
+    to->dead[to->ndead++] = v;
+    pthread_mutex_unlock(&to->lock);
+}
+
+/* free what other threads have given back */
+void lthread_drain(void) {
+    lthread* t = lthread_self;
+    if (!t) { return; }
+    while (1) {
+        pthread_mutex_lock(&t->lock);
+        lval* v = t->ndead ? t->dead[--t->ndead] : NULL;
+        pthread_mutex_unlock(&t->lock);
+        if (!v) { return; }
+        lval_del(v);
+    }
+}
+
+void lthread_push(lthread* t, ltask* k) {
+    pthread_mutex_lock(&t->lock);
+    if (t->hi == t->cap) {
+        /* slide down over what's been stolen, or grow */
+        if (t->lo > t->cap / 2) {
+            memmove(t->tasks, t->tasks + t->lo, sizeof(ltask*) * (t->hi - t->lo));
+        } else {
+            t->cap = t->cap ? t->cap * 2 : 16;
+            t->tasks = realloc(t->tasks, sizeof(ltask*) * t->cap);
+            memmove(t->tasks, t->tasks + t->lo, sizeof(ltask*) * (t->hi - t->lo));
+        }
+        t->hi -= t->lo;
+        t->lo = 0;
+    }
+    t->tasks[t->hi++] = k;
+    pthread_mutex_unlock(&t->lock);
+}
+
+/* the newest of t's tasks if mine, otherwise the oldest */
+ltask* lthread_take(lthread* t, int mine) {
+    ltask* k = NULL;
+    pthread_mutex_lock(&t->lock);
+    if (t->lo < t->hi) {
+        k = mine ? t->tasks[--t->hi] : t->tasks[t->lo++];
+    }
+    if (t->lo == t->hi) { t->lo = t->hi = 0; }
+    pthread_mutex_unlock(&t->lock);
+    return k;
+}
+
+/* wake anyone waiting on the scheduler, n more tasks being queued */
+void lpar_wake(int n) {
+    pthread_mutex_lock(&lpar_lock);
+    __atomic_fetch_add(&lpar_queued, n, __ATOMIC_SEQ_CST);
+    pthread_cond_broadcast(&lpar_cond);
+    pthread_mutex_unlock(&lpar_lock);
+}
+
+/* find a task to run: one of ours, or if steal, one of anyone's. it
+ * counts as active from before it's taken, so a worker that finds
+ * nothing queued and nothing active knows there's nothing left */
+ltask* lpar_take(int steal) {
+    __atomic_fetch_add(&lpar_active, 1, __ATOMIC_SEQ_CST);
+
+    ltask* k = lthread_take(lthread_self, 1);
+    for (int i = 0; !k && steal && i < lpar_nthreads + 1; i++) {
+        if (lthreads[i] != lthread_self) { k = lthread_take(lthreads[i], 0); }
+    }
+
+    if (k) {
+        __atomic_fetch_sub(&lpar_queued, 1, __ATOMIC_SEQ_CST);
+    } else if (__atomic_sub_fetch(&lpar_active, 1, __ATOMIC_SEQ_CST) == 0) {
+        lpar_wake(0);
+    }
+    return k;
+}
+
+/* the owner gets back what the task was spawned with */
+void ltask_release(ltask* k) {
+    if (!k->expr) { return; }
+    lthread_give(k->owner, k->expr);
+    lthread_give(k->owner, k->syms);
+    lthread_give(k->owner, k->vals);
+    k->expr = k->syms = k->vals = NULL;
+}
+
+ltask* ltask_ref(ltask* k) {
+    __atomic_fetch_add(&k->refs, 1, __ATOMIC_RELAXED);
+    return k;
+}
+
+void ltask_drop(ltask* k) {
+    if (__atomic_sub_fetch(&k->refs, 1, __ATOMIC_ACQ_REL) > 0) { return; }
+    pthread_mutex_lock(&ltask_lock);
+    if (k->prev) { k->prev->next = k->next; } else { ltask_futures = k->next; }
+    if (k->next) { k->next->prev = k->prev; }
+    pthread_mutex_unlock(&ltask_lock);
+
+    ltask_release(k);
+    if (k->result) { lthread_give(k->maker, k->result); }
+    free(k);
+}
+
+/* stop futures starting, drain what's been handed back, and mark all
+ * that this thread's futures hold of its heap, ready for a sweep */
+void ltask_gc_begin(void) {
+    pthread_mutex_lock(&ltask_lock);
+
+    lthread* t = lthread_self;
+    if (!t) { return; }
+    pthread_mutex_lock(&t->lock);
+    for (int i = 0; i < t->ndead; i++) { gc_mark_lval(t->dead[i]); }
+    pthread_mutex_unlock(&t->lock);
+
+    for (ltask* k = ltask_futures; k; k = k->next) {
+        if (k->owner == t && k->expr) {
+            gc_mark_lval(k->expr);
+            gc_mark_lval(k->syms);
+            gc_mark_lval(k->vals);
+        }
+        if (k->maker == t && k->result) { gc_mark_lval(k->result); }
+    }
+}
+
+void ltask_gc_end(void) {
+    pthread_mutex_unlock(&ltask_lock);
+}
+
+/* (f x) or (f x y) with x and y taken as they are, consuming them */
+lval* lpar_call(lenv* e, lval* f, lval* x, lval* y) {
+    lval* a = lval_add(lval_add(lval_sexpr(), lval_ref(f)), x);
+    if (y) { a = lval_add(a, y); }
+    return lval_apply(e, a);
+}
+
+/* run chunk c of b in e with f, which are this thread's own */
+void lpar_chunk(lbatch* b, lenv* e, lval* f, int c) {
+    long n = b->items->count;
+    int lo = n * c / b->nchunks;
+    int hi = n * (c+1) / b->nchunks;
+    lval** items = b->items->cell;
+    lval* kept = lval_qexpr();
+    b->kept[c] = kept;
+    b->makers[c] = lthread_self;
+
+    if (b->job == LPAR_REDUCE) {
+        lval* acc = lval_clone(items[lo]);
+        for (int i = lo+1; i < hi && acc->type != LVAL_ERR; i++) {
+            acc = lpar_call(e, f, acc, lval_clone(items[i]));
+        }
+        b->results[c] = acc;
+        lval_add(kept, acc);
+        return;
+    }
+
+    for (int i = lo; i < hi; i++) {
+        lval* x = lpar_call(e, f, lval_clone(items[i]), NULL);
+        /* pfor only hands back errors */
+        if (b->job == LPAR_FOR && x->type != LVAL_ERR) {
+            lval_del(x);
+            continue;
+        }
+        b->results[i] = x;
+        lval_add(kept, x);
+    }
+}
+
+/* run k in a root env of its own, on a worker */
+void ltask_run(ltask* k) {
+    lenv* root = lenv_root;
+    lenv* from = lpar_env;
+    lenv_root = lenv_new();
+
+    if (k->kind == LTASK_CHUNK) {
+        lbatch* b = k->batch;
+        lpar_env = b->env;
+        lval* f = lval_clone(b->f);
+        lpar_chunk(b, lenv_root, f, k->chunk);
+        lval_del(f);
+    } else {
+        lpar_env = NULL;
+        /* what's in another thread's heap mustn't be collected under us */
+        int other = k->owner != lthread_self;
+        if (other) { pthread_mutex_lock(&ltask_lock); }
+        for (int i = 0; i < k->syms->count; i++) {
+            lval* v = lval_clone(k->vals->cell[i]);
+            lenv_put(lenv_root, k->syms->cell[i], v);
+            lval_del(v);
+        }
+        lval* x = lval_clone(k->expr);
+        x->type = LVAL_SEXPR;
+        ltask_release(k);
+        if (other) { pthread_mutex_unlock(&ltask_lock); }
+
+        lval* r = lval_eval(lenv_root, x);
+        pthread_mutex_lock(&ltask_lock);
+        k->result = r;
+        k->maker = lthread_self;
+        pthread_mutex_unlock(&ltask_lock);
+    }
+
+    lenv_del(lenv_root);
+    lenv_root = root;
+    lpar_env = from;
+
+    /* a chunk can be gone the moment the batch sees it's done */
+    int chunk = k->kind == LTASK_CHUNK;
+    pthread_mutex_lock(&lpar_lock);
+    if (chunk) {
+        k->batch->remaining--;
+    } else {
+        __atomic_store_n(&k->state, LTASK_DONE, __ATOMIC_RELEASE);
+    }
+    __atomic_fetch_sub(&lpar_active, 1, __ATOMIC_SEQ_CST);
+    pthread_cond_broadcast(&lpar_cond);
+    pthread_mutex_unlock(&lpar_lock);
+
+    /* the queue's reference */
+    if (!chunk) { ltask_drop(k); }
+}
+
+void lvm_cleanup(void);
+
+void* lpar_main(void* arg) {
+    lthread_self = arg;
+    lpar_worker = 1;
+    lval_small_init();
+
+    while (1) {
+        lthread_drain();
+        ltask* k = lpar_take(1);
+        if (k) {
+            ltask_run(k);
+            continue;
+        }
+
+        /* nothing to do; once we're told to quit, that's for good */
+        pthread_mutex_lock(&lpar_lock);
+        int quit = 0;
+        while (!__atomic_load_n(&lpar_queued, __ATOMIC_SEQ_CST)) {
+            quit = lpar_quit && !__atomic_load_n(&lpar_active, __ATOMIC_SEQ_CST);
+            if (quit) { break; }
+            pthread_cond_wait(&lpar_cond, &lpar_lock);
+        }
+        pthread_mutex_unlock(&lpar_lock);
+        if (quit) { break; }
+    }
+
+    lthread_drain();
+    lvm_cleanup();
+    lpool_cleanup(&lval_pool);
+    lpool_cleanup(&lenv_pool);
+    return NULL;
+}
+
+lthread* lthread_new(void) {
+    lthread* t = calloc(1, sizeof(lthread));
+    pthread_mutex_init(&t->lock, NULL);
+    return t;
+}
+
+/* start the workers, the first time they're wanted */
+void lpar_init(void) {
+    if (lthreads) { return; }
+
+    int n = lpar_workers;
+    if (n <= 0) { n = sysconf(_SC_NPROCESSORS_ONLN); }
+    if (n <= 0) { n = 1; }
+
+    /* everyone's queue is there before anyone goes looking in it */
+    lpar_started = 1;
+    lpar_nthreads = n;
+    lthreads = malloc(sizeof(lthread*) * (n + 1));
+    for (int i = 0; i <= n; i++) {
+        lthreads[i] = lthread_new();
+    }
+    lthread_self = lthreads[0];
+
+    lpar_threads = malloc(sizeof(pthread_t) * n);
+    for (int i = 0; i < n; i++) {
+        pthread_create(&lpar_threads[i], NULL, lpar_main, lthreads[i+1]);
+    }
+}
+
+/* wait for everything queued to be run, then stop the workers */
+void lpar_cleanup(void) {
+    if (!lthreads) { return; }
+
+    pthread_mutex_lock(&lpar_lock);
+    lpar_quit = 1;
+    pthread_cond_broadcast(&lpar_cond);
+    pthread_mutex_unlock(&lpar_lock);
+
+    for (int i = 0; i < lpar_nthreads; i++) {
+        pthread_join(lpar_threads[i], NULL);
+    }
+    lthread_drain();
+
+    for (int i = 0; i <= lpar_nthreads; i++) {
+        pthread_mutex_destroy(&lthreads[i]->lock);
+        free(lthreads[i]->tasks);
+        free(lthreads[i]->dead);
+        free(lthreads[i]);
+    }
+    free(lthreads);
+    free(lpar_threads);
+    lthreads = NULL;
+    lpar_threads = NULL;
+    lthread_self = NULL;
+    lpar_nthreads = 0;
+    lpar_started = 0;
+}
+
+/* call f over items for job, in e, leaving both be. returns a copy of
+ * the results in a list (or an empty sexpr for pfor), or the first error */
+lval* lpar_do(lenv* e, int job, lval* f, lval* items) {
+    lpar_init();
+
+    lbatch b;
+    b.job = job;
+    b.env = e;
+    b.f = f;
+    b.items = items;
+
+    /* plenty of chunks, so a worker that finishes early can take more */
+    b.nchunks = lpar_nthreads * 16;
+    if (b.nchunks > items->count) { b.nchunks = items->count; }
+    b.remaining = b.nchunks;
+
+    int n = job == LPAR_REDUCE ? b.nchunks : items->count;
+    b.results = calloc(n ? n : 1, sizeof(lval*));
+    b.kept = calloc(b.nchunks ? b.nchunks : 1, sizeof(lval*));
+    b.makers = calloc(b.nchunks ? b.nchunks : 1, sizeof(lthread*));
+
+    if (lpar_worker) {
+        /* nothing of a worker's holds still while it waits, so it does
+         * all this itself */
+        for (int c = 0; c < b.nchunks; c++) {
+            lpar_chunk(&b, e, f, c);
+        }
+    } else {
+        ltask* tasks = calloc(b.nchunks ? b.nchunks : 1, sizeof(ltask));
+        for (int c = 0; c < b.nchunks; c++) {
+            tasks[c].kind = LTASK_CHUNK;
+            tasks[c].batch = &b;
+            tasks[c].chunk = c;
+            lthread_push(lthread_self, &tasks[c]);
+        }
+        lpar_wake(b.nchunks);
+
+        pthread_mutex_lock(&lpar_lock);
+        while (b.remaining) { pthread_cond_wait(&lpar_cond, &lpar_lock); }
+        pthread_mutex_unlock(&lpar_lock);
+        free(tasks);
+    }
+
+    lval* r = job == LPAR_FOR ? lval_sexpr() : lval_qexpr();
+    for (int i = 0; i < n; i++) {
+        lval* x = b.results[i];
+        if (!x) { continue; }
+        if (x->type == LVAL_ERR) {
+            lval_del(r);
+            r = lval_clone(x);
+            break;
+        }
+        r = lval_add(r, lval_clone(x));
+    }
+
+    for (int c = 0; c < b.nchunks; c++) {
+        lthread_give(b.makers[c], b.kept[c]);
+    }
+    free(b.results);
+    free(b.kept);
+    free(b.makers);
+    lthread_drain();
+    return r;
+}
+
+lval* builtin_pmap(lenv* e, lval* a) {
+    LASSERT_NUM("pmap", a, 2);
+    LASSERT_TYPE("pmap", a, 0, LVAL_FUN);
+    LASSERT_TYPE("pmap", a, 1, LVAL_QEXPR);
+
+    lval* x = lpar_do(e, LPAR_MAP, a->cell[0], a->cell[1]);
+    lval_del(a);
+    return x;
+}
+
+lval* builtin_pfor(lenv* e, lval* a) {
+    LASSERT_NUM("pfor", a, 2);
+    LASSERT_TYPE("pfor", a, 0, LVAL_FUN);
+    LASSERT_TYPE("pfor", a, 1, LVAL_QEXPR);
+
+    lval* x = lpar_do(e, LPAR_FOR, a->cell[0], a->cell[1]);
+    lval_del(a);
+    return x;
+}
+
+/* (preduce f init {xs}): f must be associative, as runs of xs are folded
+ * separately before init is folded through what they come to */
+lval* builtin_preduce(lenv* e, lval* a) {
+    LASSERT_NUM("preduce", a, 3);
+    LASSERT_TYPE("preduce", a, 0, LVAL_FUN);
+    LASSERT_TYPE("preduce", a, 2, LVAL_QEXPR);
+
+    lval* parts = lpar_do(e, LPAR_REDUCE, a->cell[0], a->cell[2]);
+    if (parts->type == LVAL_ERR) {
+        lval_del(a);
+        return parts;
+    }
+
+    lval* acc = lval_ref(a->cell[1]);
+    while (parts->count && acc->type != LVAL_ERR) {
+        acc = lpar_call(e, a->cell[0], acc, lval_pop(parts, 0));
+    }
+
+    lval_del(parts);
+    lval_del(a);
+    return acc;
+}
+
+/* note down a copy of the value of every name v could look up in e,
+ * following into the bodies of the functions they turn out to be */
+void ltask_capture(lenv* e, lval* v, ltask* k) {
+    switch (v->type) {
+        case LVAL_SYM: {
+            for (int i = 0; i < k->syms->count; i++) {
+                if (k->syms->cell[i]->sym == v->sym) { return; }
+            }
+            lval* x = lenv_get(e, v);
+            if (x->type == LVAL_ERR) {
+                lval_del(x);
+                return;
+            }
+            lval* c = lval_clone(x);
+            lval_del(x);
+            k->syms = lval_add(k->syms, lval_ref(v));
+            k->vals = lval_add(k->vals, c);
+            ltask_capture(e, c, k);
+        }
+        break;
+        case LVAL_SEXPR:
+        case LVAL_QEXPR:
+            for (int i = 0; i < v->count; i++) {
+                ltask_capture(e, v->cell[i], k);
+            }
+        break;
+        case LVAL_FUN:
+            if (!v->builtin) {
+                ltask_capture(e, v->body, k);
+                for (int i = 0; i < v->env->count; i++) {
+                    ltask_capture(e, v->env->vals[i], k);
+                }
+            }
+        break;
+    }
+}
+
+/* (spawn {expr}) evaluates expr on a worker, like eval would here */
+lval* builtin_spawn(lenv* e, lval* a) {
+    LASSERT_NUM("spawn", a, 1);
+    LASSERT_TYPE("spawn", a, 0, LVAL_QEXPR);
+
+    lpar_init();
+    lthread_drain();
+
+    ltask* k = calloc(1, sizeof(ltask));
+    k->kind = LTASK_FUTURE;
+    k->refs = 2;
+    k->state = LTASK_QUEUED;
+    k->owner = lthread_self;
+    k->expr = lval_clone(a->cell[0]);
+    k->syms = lval_qexpr();
+    k->vals = lval_qexpr();
+    ltask_capture(e, k->expr, k);
+
+    pthread_mutex_lock(&ltask_lock);
+    k->next = ltask_futures;
+    if (k->next) { k->next->prev = k; }
+    ltask_futures = k;
+    pthread_mutex_unlock(&ltask_lock);
+
+    lval* x = lval_alloc(LVAL_FUT);
+    x->task = k;
+    lthread_push(lthread_self, k);
+    lpar_wake(1);
+
+    lval_del(a);
+    return x;
+}
+
+/* the value of a future, once it has one */
+lval* builtin_await(lenv* e, lval* a) {
+    LASSERT_NUM("await", a, 1);
+    LASSERT_TYPE("await", a, 0, LVAL_FUT);
+
+    ltask* k = a->cell[0]->task;
+    while (__atomic_load_n(&k->state, __ATOMIC_ACQUIRE) != LTASK_DONE) {
+        ltask* j = lpar_worker ? lpar_take(0) : NULL;
+        if (j) {
+            ltask_run(j);
+            continue;
+        }
+        pthread_mutex_lock(&lpar_lock);
+        while (__atomic_load_n(&k->state, __ATOMIC_ACQUIRE) != LTASK_DONE) {
+            pthread_cond_wait(&lpar_cond, &lpar_lock);
+        }
+        pthread_mutex_unlock(&lpar_lock);
+    }
+
+    lval* x = lval_clone(k->result);
+    lval_del(a);
+    lthread_drain();
+    return x;
+}
+
+/*
+ * packing values
+ *
+ * a compact binary form for values, and for envs of them, written
+ * straight to a file. (serialize) and (deserialize) use it for single
+ * values, and --dump-image for the whole global env, so it can be mapped
+ * back in at startup instead of loading a prelude again. files start
+ * with a magic string and the version. integers and lengths are varints;
+ * a double that's a short decimal is its digits as one and the number of
+ * them after the point, and any other its bits, little end first.
+ * symbols go by name and builtins by the name they were registered
+ * under. futures can't be packed.
+ *
+ * names, and the text of strings and errors, are written out in full
+ * only the first time; after that it's the number of the earlier one,
+ * counting from 0 in the order they came. a varint of the length times
+ * two plus one is a new one, with its bytes following, and the number
+ * times two is an old one, so the tables build up as they're read.
+ */
+
+/* what each packed value starts with. these are part of the format, so
+ * only ever add to them; bump LPACK_VERSION if any meaning changes */
+enum { LPACK_NUM, LPACK_DBL, LPACK_BIG, LPACK_STR, LPACK_SYM, LPACK_ERR,
+       LPACK_SEXPR, LPACK_QEXPR, LPACK_BUILTIN, LPACK_LAMBDA,
+       LPACK_IVEC, LPACK_DVEC, LPACK_DEC };
+
+#define LPACK_VERSION 2
+
+/* what files start with, before the version */
+#define LPACK_MAGIC "lispyval"
+#define LIMAGE_MAGIC "lispyimg"
+
+/* how much to pack before writing it out */
+#define LPACK_CHUNK 65536
+
+/* values nested deeper than this are taken to be corrupt, rather than
+ * unpacked recursively until the C stack runs out */
+#define LPACK_DEPTH_MAX 10000
+
+/* every builtin there is, by the name lenv_add_builtin gave it */
+latom** lbuiltin_names = NULL;
+lbuiltin* lbuiltin_funcs = NULL;
+int lbuiltin_count = 0;
+
+/* the name func was registered under, or NULL */
+latom* lbuiltin_name(lbuiltin func) {
+    for (int i = 0; i < lbuiltin_count; i++) {
+        if (lbuiltin_funcs[i] == func) { return lbuiltin_names[i]; }
+    }
+    return NULL;
+}
+
+/* strings written so far, in order, and open-addressed by their hash,
+ * each slot holding the number of one plus 1, or 0 if it's empty */
+typedef struct lpack_seen {
+    char** strs;
+    long* lens;
+    unsigned long* hashes;
+    int count;
+    int* slots;
+    int nslots;
+} lpack_seen;
+
+/* bytes being packed, and the file they're going to */
+typedef struct lpack {
+    char* path;
+    FILE* f;
+    /* set if anything failed to be written */
+    int failed;
+    unsigned char* data;
+    long len;
+    /* bytes written altogether */
+    long total;
+    /* names, and the text of strings and errors */
+    lpack_seen names;
+    lpack_seen strs;
+} lpack;
+
+void lpack_flush(lpack* p) {
+    if (p->len && fwrite(p->data, 1, p->len, p->f) != (size_t)p->len) {
+        p->failed = 1;
+    }
+    p->len = 0;
+}
+
+void lpack_bytes(lpack* p, const void* s, long n) {
+    p->total += n;
+    if (p->len + n > LPACK_CHUNK) {
+        lpack_flush(p);
+        if (n > LPACK_CHUNK) {
+            if (fwrite(s, 1, n, p->f) != (size_t)n) { p->failed = 1; }
+            return;
+        }
+    }
+    memcpy(p->data + p->len, s, n);
+    p->len += n;
+}
+
+void lpack_byte(lpack* p, int c) {
+    unsigned char b = c;
+    lpack_bytes(p, &b, 1);
+}
+
+/* seven bits at a time, the high bit set on all but the last */
+void lpack_uint(lpack* p, uint64_t x) {
+    unsigned char b[10];
+    int n = 0;
+    while (x >= 0x80) {
+        b[n++] = (x & 0x7f) | 0x80;
+        x >>= 7;
+    }
+    b[n++] = x;
+    lpack_bytes(p, b, n);
+}
+
+/* zigzagged so small negatives are short too */
+void lpack_int(lpack* p, long x) {
+    lpack_uint(p, ((uint64_t)x << 1) ^ (uint64_t)(x < 0 ? -1 : 0));
+}
+
+void lpack_dbl(lpack* p, double x) {
+    uint64_t bits;
+    memcpy(&bits, &x, 8);
+    unsigned char b[8];
+    for (int i = 0; i < 8; i++) { b[i] = bits >> (8 * i); }
+    lpack_bytes(p, b, 8);
+}
+
+/* powers of ten that are exact as doubles */
+#define LPACK_DEC_MAX 22
+const double lpack_pow10[LPACK_DEC_MAX + 1] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+
+/* x as m / 10^e, for the fewest digits after the point that give x back
+ * exactly. both sides of the division are exact, so it rounds the once
+ * and reads back the same anywhere. returns 0 if m won't fit 53 bits */
+int lpack_dec(double x, long* m, int* e) {
+    for (*e = 0; *e <= LPACK_DEC_MAX; (*e)++) {
+        double y = x * lpack_pow10[*e];
+        /* false for infinities and NaNs as well */
+        if (!(y > -9007199254740992.0 && y < 9007199254740992.0)) { return 0; }
+        *m = (long)y;
+        double back = (double)*m / lpack_pow10[*e];
+        /* compared by their bits, so -0.0 isn't taken for 0 */
+        if (memcmp(&back, &x, sizeof(double)) == 0) { return 1; }
+    }
+    return 0;
+}
+
+/* s, n bytes of it hashing to h, in full if t hasn't seen it before and
+ * by its number if it has */
+void lpack_seen_write(lpack* p, lpack_seen* t, char* s, long n, unsigned long h) {
+    if (t->count * 2 >= t->nslots) {
+        int nslots = t->nslots ? t->nslots * 2 : 256;
+        int* slots = calloc(nslots, sizeof(int));
+        for (int i = 0; i < t->count; i++) {
+            unsigned long j = t->hashes[i] & (nslots - 1);
+            while (slots[j]) { j = (j + 1) & (nslots - 1); }
+            slots[j] = i + 1;
+        }
+        free(t->slots);
+        t->slots = slots;
+        t->nslots = nslots;
+        t->strs = realloc(t->strs, sizeof(char*) * nslots / 2);
+        t->lens = realloc(t->lens, sizeof(long) * nslots / 2);
+        t->hashes = realloc(t->hashes, sizeof(unsigned long) * nslots / 2);
+    }
+
+    unsigned long mask = t->nslots - 1;
+    unsigned long j = h & mask;
+    for (; t->slots[j]; j = (j + 1) & mask) {
+        int i = t->slots[j] - 1;
+        if (t->hashes[i] == h && t->lens[i] == n && memcmp(t->strs[i], s, n) == 0) {
+            lpack_uint(p, (uint64_t)i << 1);
+            return;
+        }
+    }
+    t->slots[j] = t->count + 1;
+    t->strs[t->count] = s;
+    t->lens[t->count] = n;
+    t->hashes[t->count] = h;
+    t->count++;
+    lpack_uint(p, ((uint64_t)n << 1) | 1);
+    lpack_bytes(p, s, n);
+}
+
+void lpack_seen_free(lpack_seen* t) {
+    free(t->strs);
+    free(t->lens);
+    free(t->hashes);
+    free(t->slots);
+}
+
+/* the text of a string or error */
+void lpack_text(lpack* p, char* s) {
+    long n = strlen(s);
+    lpack_seen_write(p, &p->strs, s, n, latom_hash(s, n));
+}
+
+/* start packing to a new file at path, which begins with magic and the
+ * version. returns an error if it can't be created */
+lval* lpack_open(lpack* p, char* path, char* magic) {
+    memset(p, 0, sizeof(lpack));
+    p->path = path;
+    p->f = fopen(path, "wb");
+    if (!p->f) { return lval_err("%s: %s", path, strerror(errno)); }
+    p->data = malloc(LPACK_CHUNK);
+    lpack_bytes(p, magic, strlen(magic));
+    lpack_uint(p, LPACK_VERSION);
+    return NULL;
+}
+
+/* finish the file, or if err (from packing) is given, remove what there
+ * is of it. returns err, an error if writing failed, or NULL */
+lval* lpack_close(lpack* p, lval* err) {
+    lpack_flush(p);
+    if (fclose(p->f) != 0) { p->failed = 1; }
+    if (!err && p->failed) { err = lval_err("%s: %s", p->path, strerror(errno)); }
+    if (err) { remove(p->path); }
+    free(p->data);
+    lpack_seen_free(&p->names);
+    lpack_seen_free(&p->strs);
+    return err;
+}
+
+/* a's name, or its number if it's been written already */
+void lpack_atom(lpack* p, latom* a) {
+    lpack_seen_write(p, &p->names, a->name, strlen(a->name), a->hash);
+}
+
+lval* lval_pack(lpack* p, lval* v);
+
+/* the names e binds and their values */
+lval* lenv_pack(lpack* p, lenv* e) {
+    lpack_uint(p, e->count);
+    for (int i = 0; i < e->count; i++) {
+        lpack_atom(p, e->syms[i]);
+        lval* err = lval_pack(p, e->vals[i]);
+        if (err) { return err; }
+    }
+    return NULL;
+}
+
+/* append v to p. returns NULL, or an error if v holds something that
+ * can't be packed, leaving p part way through */
+lval* lval_pack(lpack* p, lval* v) {
+    switch (v->type) {
+        case LVAL_NUM:
+            lpack_byte(p, LPACK_NUM);
+            lpack_int(p, v->num);
+            return NULL;
+
+        case LVAL_DBL: {
+            long m;
+            int e;
+            if (lpack_dec(v->dbl, &m, &e)) {
+                lpack_byte(p, LPACK_DEC);
+                lpack_int(p, m);
+                lpack_byte(p, e);
+            } else {
+                lpack_byte(p, LPACK_DBL);
+                lpack_dbl(p, v->dbl);
+            }
+            return NULL;
+        }
+
+        case LVAL_BIG:
+            lpack_byte(p, LPACK_BIG);
+            lpack_int(p, v->big->sign);
+            lpack_uint(p, v->big->n);
+            for (int i = 0; i < v->big->n; i++) { lpack_uint(p, v->big->d[i]); }
+            return NULL;
+
+        case LVAL_STR:
+            lpack_byte(p, LPACK_STR);
+            lpack_text(p, v->str);
+            return NULL;
+
+        case LVAL_SYM:
+            lpack_byte(p, LPACK_SYM);
+            lpack_atom(p, v->sym);
+            return NULL;
+
+        case LVAL_ERR:
+            lpack_byte(p, LPACK_ERR);
+            lpack_text(p, v->err);
+            return NULL;
+
+        case LVAL_SEXPR:
+        case LVAL_QEXPR:
+            lpack_byte(p, v->type == LVAL_SEXPR ? LPACK_SEXPR : LPACK_QEXPR);
+            lpack_uint(p, v->count);
+            for (int i = 0; i < v->count; i++) {
+                lval* err = lval_pack(p, v->cell[i]);
+                if (err) { return err; }
+            }
+            return NULL;
+
+        case LVAL_FUN: {
+            if (v->builtin) {
+                latom* name = lbuiltin_name(v->builtin);
+                if (!name) { return lval_err("Cannot pack an unregistered builtin"); }
+                lpack_byte(p, LPACK_BUILTIN);
+                lpack_atom(p, name);
+                return NULL;
+            }
+            lpack_byte(p, LPACK_LAMBDA);
+            lval* err = lenv_pack(p, v->env);
+            if (!err) { err = lval_pack(p, v->formals); }
+            if (!err) { err = lval_pack(p, v->body); }
+            return err;
+        }
+
+        case LVAL_VEC:
+            lpack_byte(p, v->vdbl ? LPACK_DVEC : LPACK_IVEC);
+            lpack_uint(p, v->vlen);
+            for (int i = 0; i < v->vlen; i++) {
+                if (v->vdbl) {
+                    lpack_dbl(p, v->dvec[i]);
+                } else {
+                    lpack_int(p, v->ivec[i]);
+                }
+            }
+            return NULL;
+    }
+    return lval_err("Cannot pack a %s", ltype_name(v->type));
+}
+
+/* bytes being unpacked. everything read is checked against end, and
+ * bad is set rather than reading past it */
+typedef struct lunpack {
+    unsigned char* at;
+    unsigned char* end;
+    int bad;
+    /* the file mapping it's all in */
+    void* map;
+    long len;
+    /* the names read so far, in order */
+    latom** names;
+    int count;
+    int cap;
+    /* likewise the text of strings and errors, which stays in the map */
+    char** strs;
+    long* lens;
+    int nstrs;
+    int strcap;
+    /* how many values deep we are; see LPACK_DEPTH_MAX */
+    int depth;
+} lunpack;
+
+int lunpack_byte(lunpack* u) {
+    if (u->at == u->end) {
+        u->bad = 1;
+        return 0;
+    }
+    return *u->at++;
+}
+
+uint64_t lunpack_uint(lunpack* u) {
+    uint64_t x = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        int b = lunpack_byte(u);
+        x |= (uint64_t)(b & 0x7f) << shift;
+        if (!(b & 0x80)) { return x; }
+    }
+    u->bad = 1;
+    return 0;
+}
+
+long lunpack_int(lunpack* u) {
+    uint64_t x = lunpack_uint(u);
+    return (long)(x >> 1) ^ -(long)(x & 1);
+}
+
+/* a count of things at least one byte each; anything more than there
+ * are bytes left is corrupt */
+long lunpack_count(lunpack* u) {
+    uint64_t n = lunpack_uint(u);
+    if (n > (uint64_t)(u->end - u->at)) {
+        u->bad = 1;
+        return 0;
+    }
+    return n;
+}
+
+double lunpack_dbl(lunpack* u) {
+    if (u->end - u->at < 8) {
+        u->bad = 1;
+        return 0;
+    }
+    uint64_t bits = 0;
+    for (int i = 0; i < 8; i++) { bits |= (uint64_t)u->at[i] << (8 * i); }
+    u->at += 8;
+    double x;
+    memcpy(&x, &bits, 8);
+    return x;
+}
+
+/* the next n bytes, which stay where they are. NULL if there aren't
+ * enough */
+char* lunpack_bytes(lunpack* u, uint64_t n) {
+    if (n > (uint64_t)(u->end - u->at)) {
+        u->bad = 1;
+        return NULL;
+    }
+    char* s = (char*)u->at;
+    u->at += n;
+    return s;
+}
+
+/* a name, written in full or by number; NULL if it's corrupt */
+latom* lunpack_atom(lunpack* u) {
+    uint64_t k = lunpack_uint(u);
+    if (u->bad) { return NULL; }
+    if (!(k & 1)) {
+        if (k >> 1 >= (uint64_t)u->count) {
+            u->bad = 1;
+            return NULL;
+        }
+        return u->names[k >> 1];
+    }
+
+    char* s = lunpack_bytes(u, k >> 1);
+    if (!s) { return NULL; }
+    if (u->count == u->cap) {
+        u->cap = u->cap ? u->cap * 2 : 256;
+        u->names = realloc(u->names, sizeof(latom*) * u->cap);
+    }
+    return u->names[u->count++] = latom_intern_len(s, k >> 1);
+}
+
+/* the text of a string or error, and its length in n, written in full
+ * or by number; NULL if it's corrupt */
+char* lunpack_text(lunpack* u, long* n) {
+    uint64_t k = lunpack_uint(u);
+    if (u->bad) { return NULL; }
+    if (!(k & 1)) {
+        if (k >> 1 >= (uint64_t)u->nstrs) {
+            u->bad = 1;
+            return NULL;
+        }
+        *n = u->lens[k >> 1];
+        return u->strs[k >> 1];
+    }
+
+    char* s = lunpack_bytes(u, k >> 1);
+    if (!s) { return NULL; }
+    if (u->nstrs == u->strcap) {
+        u->strcap = u->strcap ? u->strcap * 2 : 256;
+        u->strs = realloc(u->strs, sizeof(char*) * u->strcap);
+        u->lens = realloc(u->lens, sizeof(long) * u->strcap);
+    }
+    *n = k >> 1;
+    u->strs[u->nstrs] = s;
+    u->lens[u->nstrs++] = *n;
+    return s;
 }
 
-lval* builtin_mul(lenv* e, lval* a) {
-    return builtin_op(e, a, "*");
+lval* lval_unpack(lunpack* u);
+
+/* read pairs of names and values into e. returns an error if they're
+ * corrupt */
+lval* lenv_unpack(lunpack* u, lenv* e) {
+    long count = lunpack_count(u);
+    lval* k = lval_alloc(LVAL_SYM);
+    for (long i = 0; i < count && !u->bad; i++) {
+        k->sym = lunpack_atom(u);
+        if (!k->sym) { break; }
+
+        lval* v = lval_unpack(u);
+        if (v->type == LVAL_ERR && u->bad) {
+            lval_del(k);
+            return v;
+        }
+        lenv_put(e, k, v);
+        lval_del(v);
+    }
+    lval_del(k);
+    return u->bad ? lval_err("Corrupt packed data") : NULL;
 }
 
-lval* builtin_div(lenv* e, lval* a) {
-    return builtin_op(e, a, "/");
+lval* lval_unpack_value(lunpack* u);
+
+/* the next value in u, or an error with bad set if it's corrupt. (a
+ * packed error comes back as an error too, but leaves bad be) */
+lval* lval_unpack(lunpack* u) {
+    if (u->depth == LPACK_DEPTH_MAX) {
+        u->bad = 1;
+        return lval_err("Corrupt packed data; nested too deep");
+    }
+    u->depth++;
+    lval* v = lval_unpack_value(u);
+    u->depth--;
+    return v;
 }
 
-lval* builtin_gt(lenv* e, lval* a) {
-    return builtin_ord(e, a, ">");
+lval* lval_unpack_value(lunpack* u) {
+    int tag = lunpack_byte(u);
+    if (u->bad) { return lval_err("Corrupt packed data"); }
+
+    lval* v = NULL;
+    switch (tag) {
+        case LPACK_NUM: v = lval_num(lunpack_int(u)); break;
+        case LPACK_DBL: v = lval_dbl(lunpack_dbl(u)); break;
+
+        case LPACK_DEC: {
+            long m = lunpack_int(u);
+            int e = lunpack_byte(u);
+            if (u->bad || e > LPACK_DEC_MAX) {
+                u->bad = 1;
+                break;
+            }
+            v = lval_dbl((double)m / lpack_pow10[e]);
+            break;
+        }
+
+        case LPACK_BIG: {
+            int sign = lunpack_int(u) < 0 ? -1 : 1;
+            long n = lunpack_count(u);
+            if (u->bad) { break; }
+            lbig* b = lbig_new(n);
+            b->sign = sign;
+            for (long i = 0; i < n; i++) {
+                uint64_t d = lunpack_uint(u);
+                if (d > UINT32_MAX) { u->bad = 1; }
+                b->d[i] = d;
+            }
+            if (u->bad) {
+                free(b);
+                break;
+            }
+            lbig_trim(b);
+            v = lval_big(b);
+            break;
+        }
+
+        case LPACK_SYM: {
+            latom* a = lunpack_atom(u);
+            if (!a) { break; }
+            v = lval_alloc(LVAL_SYM);
+            v->sym = a;
+            break;
+        }
+
+        case LPACK_STR:
+        case LPACK_ERR: {
+            long n;
+            char* s = lunpack_text(u, &n);
+            if (!s) { break; }
+            v = lval_alloc(tag == LPACK_STR ? LVAL_STR : LVAL_ERR);
+            char* t = malloc(n + 1);
+            memcpy(t, s, n);
+            t[n] = '\0';
+            if (tag == LPACK_STR) { v->str = t; } else { v->err = t; }
+            break;
+        }
+
+        case LPACK_SEXPR:
+        case LPACK_QEXPR: {
+            long n = lunpack_count(u);
+            v = tag == LPACK_SEXPR ? lval_sexpr() : lval_qexpr();
+            if (u->bad || n == 0) { break; }
+            lval_reserve(v, n);
+            for (long i = 0; i < n; i++) {
+                lval* x = lval_unpack(u);
+                if (u->bad) {
+                    lval_del(v);
+                    return x;
+                }
+                v->cell[v->count++] = x;
+                v->cells->hi++;
+            }
+            break;
+        }
+
+        case LPACK_BUILTIN: {
+            latom* name = lunpack_atom(u);
+            if (!name) { break; }
+            for (int i = 0; i < lbuiltin_count; i++) {
+                if (lbuiltin_names[i] == name) { v = lval_fun(lbuiltin_funcs[i]); }
+            }
+            if (!v) {
+                u->bad = 1;
+                return lval_err("Packed data names an unknown builtin '%s'", name->name);
+            }
+            break;
+        }
+
+        case LPACK_LAMBDA: {
+            lenv* env = lenv_new();
+            lval* err = lenv_unpack(u, env);
+            if (err) {
+                lenv_del(env);
+                return err;
+            }
+            lval* formals = lval_unpack(u);
+            if (u->bad) {
+                lenv_del(env);
+                return formals;
+            }
+            lval* body = lval_unpack(u);
+            if (u->bad) {
+                lenv_del(env);
+                lval_del(formals);
+                return body;
+            }
+            /* anything else would trip up calling it */
+            int ok = formals->type == LVAL_QEXPR && body->type == LVAL_QEXPR;
+            for (int i = 0; ok && i < formals->count; i++) {
+                ok = formals->cell[i]->type == LVAL_SYM;
+            }
+            if (!ok) {
+                lenv_del(env);
+                lval_del(formals);
+                lval_del(body);
+                u->bad = 1;
+                return lval_err("Corrupt packed data; malformed function");
+            }
+            /* compiled when it's first called, which is often never */
+            v = lval_lambda(formals, body);
+            lenv_del(v->env);
+            v->env = env;
+            break;
+        }
+
+        case LPACK_IVEC:
+        case LPACK_DVEC: {
+            long n = lunpack_count(u);
+            if (u->bad) { break; }
+            v = lval_vec(n, tag == LPACK_DVEC);
+            for (long i = 0; i < n; i++) {
+                if (v->vdbl) {
+                    v->dvec[i] = lunpack_dbl(u);
+                } else {
+                    v->ivec[i] = lunpack_int(u);
+                }
+            }
+            break;
+        }
+
+        default:
+            u->bad = 1;
+            return lval_err("Corrupt packed data; unknown tag %i", tag);
+    }
+
+    if (u->bad) {
+        if (v) { lval_del(v); }
+        return lval_err("Corrupt packed data");
+    }
+    return v;
 }
 
-lval* builtin_lt(lenv* e, lval* a) {
-    return builtin_ord(e, a, "<");
+/* map the file at path to unpack, checking it's what (a description)
+ * by its magic and that it's the version we write. returns an error if
+ * it isn't */
+lval* lunpack_open(lunpack* u, char* path, char* magic, char* what) {
+    memset(u, 0, sizeof(lunpack));
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        lval* err = lval_err("%s: %s", path, strerror(errno));
+        if (fd >= 0) { close(fd); }
+        return err;
+    }
+
+    long len = st.st_size;
+    long n = strlen(magic);
+    if (len < n) {
+        close(fd);
+        return lval_err("%s is not %s", path, what);
+    }
+    void* m = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (m == MAP_FAILED) { return lval_err("%s: %s", path, strerror(errno)); }
+
+    u->map = m;
+    u->len = len;
+    u->at = m;
+    u->end = u->at + len;
+    if (memcmp(m, magic, n) != 0) { return lval_err("%s is not %s", path, what); }
+    u->at += n;
+    uint64_t version = lunpack_uint(u);
+    if (version != LPACK_VERSION) {
+        return lval_err("%s is version %li, not %i", path, (long)version, LPACK_VERSION);
+    }
+    return NULL;
 }
 
-lval* builtin_ge(lenv* e, lval* a) {
-    return builtin_ord(e, a, ">=");
+void lunpack_close(lunpack* u) {
+    free(u->names);
+    free(u->strs);
+    free(u->lens);
+    if (u->map) { munmap(u->map, u->len); }
 }
 
-lval* builtin_le(lenv* e, lval* a) {
-    return builtin_ord(e, a, "<=");
+/* prefix the message of err with what failed, consuming err */
+lval* lpack_fail(char* what, lval* err) {
+    lval* x = lval_err("%s; %s", what, err->err);
+    lval_del(err);
+    return x;
 }
 
-lval* builtin_eq(lenv* e, lval* a) {
-    return builtin_cmp(e, a, "==");
+/* save e's bindings, bar the builtins still under their own names, as
+ * an image at path */
+lval* limage_dump(lenv* e, char* path) {
+    lpack p;
+    lval* err = lpack_open(&p, path, LIMAGE_MAGIC);
+    if (err) { return lpack_fail("Cannot dump image", err); }
+
+    long n = 0;
+    for (int i = 0; i < e->count; i++) {
+        lval* v = e->vals[i];
+        if (v->type == LVAL_FUN && v->builtin && lbuiltin_name(v->builtin) == e->syms[i]) {
+            continue;
+        }
+        n++;
+    }
+    lpack_uint(&p, n);
+
+    for (int i = 0; i < e->count && !err; i++) {
+        lval* v = e->vals[i];
+        if (v->type == LVAL_FUN && v->builtin && lbuiltin_name(v->builtin) == e->syms[i]) {
+            continue;
+        }
+        lpack_atom(&p, e->syms[i]);
+        if ((err = lval_pack(&p, v))) {
+            lval* x = lval_err("'%s': %s", e->syms[i]->name, err->err);
+            lval_del(err);
+            err = x;
+        }
+    }
+
+    err = lpack_close(&p, err);
+    return err ? lpack_fail("Cannot dump image", err) : NULL;
 }
 
-lval* builtin_ne(lenv* e, lval* a) {
-    return builtin_cmp(e, a, "!=");
+/* define everything in the image at path in e, which it maps and reads
+ * in place */
+lval* limage_load(lenv* e, char* path) {
+    lunpack u;
+    lval* err = lunpack_open(&u, path, LIMAGE_MAGIC, "an image");
+    if (!err) { err = lenv_unpack(&u, e); }
+    lunpack_close(&u);
+    if (err) { return lpack_fail("Cannot load image", err); }
+
+    /* names aren't packed, so lambdas go by what they're bound to now */
+    for (int i = 0; i < e->count; i++) {
+        lval* v = e->vals[i];
+        if (v->type == LVAL_FUN && !v->builtin && !v->env->name) {
+            v->env->name = e->syms[i];
+        }
+    }
+    return NULL;
+}
+
+/* (serialize "file" x) writes x to file packed, and returns how many
+ * bytes that came to */
+lval* builtin_serialize(lenv* e, lval* a) {
+    LASSERT_NUM("serialize", a, 2);
+    LASSERT_TYPE("serialize", a, 0, LVAL_STR);
+
+    lpack p;
+    lval* err = lpack_open(&p, a->cell[0]->str, LPACK_MAGIC);
+    if (!err) {
+        err = lpack_close(&p, lval_pack(&p, a->cell[1]));
+    }
+    lval_del(a);
+    return err ? lpack_fail("Cannot serialize", err) : lval_num(p.total);
+}
+
+/* (deserialize "file") is the value serialize wrote there */
+lval* builtin_deserialize(lenv* e, lval* a) {
+    LASSERT_NUM("deserialize", a, 1);
+    LASSERT_TYPE("deserialize", a, 0, LVAL_STR);
+
+    lunpack u;
+    lval* err = lunpack_open(&u, a->cell[0]->str, LPACK_MAGIC, "a serialized value");
+    lval* x = err;
+    if (!err) {
+        x = lval_unpack(&u);
+        if (u.bad) {
+            x = lpack_fail("Cannot deserialize", x);
+        } else if (u.at != u.end) {
+            lval_del(x);
+            x = lval_err("Cannot deserialize; %s has more after the value", a->cell[0]->str);
+        }
+    } else {
+        x = lpack_fail("Cannot deserialize", err);
+    }
+    lunpack_close(&u);
+    lval_del(a);
+    return x;
 }
 
 /* register a builtin function in lenv */
@@ -924,6 +5052,15 @@ void lenv_add_builtin(lenv* e, char* name, lbuiltin func) {
     lval* v = lval_fun(func);
     lenv_put(e, k, v);
     lval_del(k); lval_del(v);
+
+    /* remember the name, for packing */
+    if (!lbuiltin_name(func)) {
+        lbuiltin_names = realloc(lbuiltin_names, sizeof(latom*) * (lbuiltin_count + 1));
+        lbuiltin_funcs = realloc(lbuiltin_funcs, sizeof(lbuiltin) * (lbuiltin_count + 1));
+        lbuiltin_names[lbuiltin_count] = latom_intern(name);
+        lbuiltin_funcs[lbuiltin_count] = func;
+        lbuiltin_count++;
+    }
 }
 
 void lenv_add_builtins(lenv* e) {
@@ -954,64 +5091,670 @@ void lenv_add_builtins(lenv* e) {
     lenv_add_builtin(e, "if",    builtin_if);
     /* string functions */
     lenv_add_builtin(e, "load",  builtin_load);
+    lenv_add_builtin(e, "serialize", builtin_serialize);
+    lenv_add_builtin(e, "deserialize", builtin_deserialize);
     lenv_add_builtin(e, "error", builtin_error);
     lenv_add_builtin(e, "print", builtin_print);
+    lenv_add_builtin(e, "to-string", builtin_to_string);
+    /* vector functions */
+    lenv_add_builtin(e, "vec",   builtin_vec);
+    lenv_add_builtin(e, "vrange", builtin_vrange);
+    lenv_add_builtin(e, "vlist", builtin_vlist);
+    lenv_add_builtin(e, "vlen",  builtin_vlen);
+    lenv_add_builtin(e, "vsum",  builtin_vsum);
+    lenv_add_builtin(e, "vdot",  builtin_vdot);
+    lenv_add_builtin(e, "vmin",  builtin_vmin);
+    lenv_add_builtin(e, "vmax",  builtin_vmax);
+    lenv_add_builtin(e, "vmap+", builtin_vadd);
+    lenv_add_builtin(e, "vmap-", builtin_vsub);
+    lenv_add_builtin(e, "vmap*", builtin_vmul);
+    lenv_add_builtin(e, "vmap/", builtin_vdiv);
+    /* parallel functions */
+    lenv_add_builtin(e, "pmap", builtin_pmap);
+    lenv_add_builtin(e, "preduce", builtin_preduce);
+    lenv_add_builtin(e, "pfor", builtin_pfor);
+    lenv_add_builtin(e, "spawn", builtin_spawn);
+    lenv_add_builtin(e, "await", builtin_await);
+    /* debugging */
+    lenv_add_builtin(e, "allocs", builtin_allocs);
+    lenv_add_builtin(e, "gc",     builtin_gc);
+    lenv_add_builtin(e, "stats",  builtin_stats);
+    lenv_add_builtin(e, "profile-start", builtin_profile_start);
+    lenv_add_builtin(e, "profile-report", builtin_profile_report);
 }
 
-lval* lval_eval_sexpr(lenv* e, lval* v) {
-    /* eval the children first */
-    for (int i = 0; i < v->count; i++) {
-        v->cell[i] = lval_eval(e, v->cell[i]);
+/*
+ * bytecode
+ *
+ * when a lambda is made its body is compiled once into a flat list of
+ * instructions for a little stack machine. formals become slots in the
+ * call's env, literals become constants, and (if c {a} {b}) becomes a
+ * conditional jump, so calling it doesn't mean re-walking (and copying)
+ * the body every time. anything the compiler doesn't like is left to
+ * the tree walker in lval_eval, as is everything with --no-vm.
+ *
+ * a call from a body to another compiled lambda runs in the same
+ * lvm_run, on a stack of calls kept on the heap, so recursion through
+ * the VM costs no more C stack than through the tree walker. each thread
+ * has one value stack that all its calls share, which grows as needed.
+ */
+
+enum {
+    /* push consts[n] */
+    LOP_CONST,
+    /* push the value bound to formal n, which lives at env->vals[n] */
+    LOP_LOCAL,
+    /* push the value of the symbol consts[n], looked up as usual */
+    LOP_NAME,
+    /* pop n values and evaluate them as an sexpr, pushing the result */
+    LOP_CALL,
+    /* pop n values and hand them back to lval_eval as the last call */
+    LOP_TAILCALL,
+    /* with (if cond) on top of the stack: pop both and jump to the
+     * first target if cond is false. if 'if' isn't the builtin or cond
+     * isn't a number, leave them be and jump to the second target */
+    LOP_IF,
+    /* jump to n */
+    LOP_JUMP,
+};
+
+int lvm_enabled = 1;
+
+struct lcode {
+    /* the formals this was compiled against; slots depend on them */
+    lval* formals;
+    /* instructions and their operands; NULL if the body didn't compile */
+    int count;
+    int* ops;
+    /* constants and the symbols LOP_NAME looks up */
+    int nconsts;
+    lval** consts;
+    /* how deep the value stack gets */
+    int depth;
+};
+
+/* the atom for "if", so the compiler can spot conditionals */
+latom* latom_if;
+
+void lcode_del(lcode* c) {
+    for (int i = 0; i < c->nconsts; i++) {
+        lval_del(c->consts[i]);
+    }
+    lval_del(c->formals);
+    free(c->consts);
+    free(c->ops);
+    free(c);
+}
+
+void gc_mark_lcode(lcode* c) {
+    gc_mark_lval(c->formals);
+    for (int i = 0; i < c->nconsts; i++) {
+        gc_mark_lval(c->consts[i]);
     }
+}
 
-    /* error checking */
-    for (int i = 0; i < v->count; i++) {
-        if (v->cell[i]->type == LVAL_ERR) {
-            return lval_take(v, i);
+void gc_unref_lcode(lcode* c) {
+    gc_unref(c->formals);
+    for (int i = 0; i < c->nconsts; i++) {
+        gc_unref(c->consts[i]);
+    }
+}
+
+void gc_free_lcode(lcode* c) {
+    free(c->consts);
+    free(c->ops);
+    free(c);
+}
+
+/* state while compiling one body */
+typedef struct lcomp {
+    lcode* code;
+    int cap;
+    /* symbol for each slot */
+    int nslots;
+    latom** slots;
+    /* current and deepest stack depth */
+    int depth;
+    /* set if we hit something we won't compile */
+    int failed;
+} lcomp;
+
+int lcomp_emit(lcomp* c, int op) {
+    if (c->code->count == c->cap) {
+        c->cap = c->cap ? c->cap * 2 : 16;
+        c->code->ops = realloc(c->code->ops, sizeof(int) * c->cap);
+    }
+    c->code->ops[c->code->count++] = op;
+    return c->code->count - 1;
+}
+
+int lcomp_const(lcomp* c, lval* x) {
+    lcode* code = c->code;
+    code->nconsts++;
+    code->consts = realloc(code->consts, sizeof(lval*) * code->nconsts);
+    code->consts[code->nconsts-1] = lval_ref(x);
+    return code->nconsts-1;
+}
+
+void lcomp_push(lcomp* c, int n) {
+    c->depth += n;
+    if (c->depth > c->code->depth) { c->code->depth = c->depth; }
+}
+
+void lcomp_sexpr(lcomp* c, lval* x, int tail);
+
+void lcomp_expr(lcomp* c, lval* x, int tail) {
+    switch (x->type) {
+        case LVAL_SYM:
+            for (int i = 0; i < c->nslots; i++) {
+                if (c->slots[i] == x->sym) {
+                    lcomp_emit(c, LOP_LOCAL);
+                    lcomp_emit(c, i);
+                    lcomp_push(c, 1);
+                    return;
+                }
+            }
+            lcomp_emit(c, LOP_NAME);
+            lcomp_emit(c, lcomp_const(c, x));
+            lcomp_push(c, 1);
+        break;
+
+        case LVAL_SEXPR: lcomp_sexpr(c, x, tail); break;
+
+        /* everything else evaluates to itself */
+        default:
+            lcomp_emit(c, LOP_CONST);
+            lcomp_emit(c, lcomp_const(c, x));
+            lcomp_push(c, 1);
+        break;
+    }
+}
+
+void lcomp_sexpr(lcomp* c, lval* x, int tail) {
+    int call = tail ? LOP_TAILCALL : LOP_CALL;
+
+    /* (if cond {then} {else}) */
+    if (x->count == 4 &&
+        x->cell[0]->type == LVAL_SYM && x->cell[0]->sym == latom_if &&
+        x->cell[2]->type == LVAL_QEXPR && x->cell[3]->type == LVAL_QEXPR) {
+
+        lcomp_expr(c, x->cell[0], 0);
+        lcomp_expr(c, x->cell[1], 0);
+        int branch = lcomp_emit(c, LOP_IF);
+        lcomp_emit(c, 0);
+        lcomp_emit(c, 0);
+
+        /* either branch runs with if and cond gone, and leaves one value */
+        int depth = c->depth;
+        int ends[2];
+        for (int b = 0; b < 2; b++) {
+            if (b) { c->code->ops[branch+1] = c->code->count; }
+            c->depth = depth - 2;
+            lcomp_sexpr(c, x->cell[2+b], tail);
+            ends[b] = lcomp_emit(c, LOP_JUMP);
+            lcomp_emit(c, 0);
         }
+
+        /* otherwise do exactly what the tree walker would */
+        c->code->ops[branch+2] = c->code->count;
+        c->depth = depth;
+        lcomp_expr(c, x->cell[2], 0);
+        lcomp_expr(c, x->cell[3], 0);
+        lcomp_emit(c, call);
+        lcomp_emit(c, 4);
+        c->depth -= 3;
+
+        c->code->ops[ends[0]+1] = c->code->count;
+        c->code->ops[ends[1]+1] = c->code->count;
+        return;
     }
 
-    /* empty expr */
-    if (v->count == 0) { return v; }
+    for (int i = 0; i < x->count; i++) {
+        lcomp_expr(c, x->cell[i], 0);
+    }
+    lcomp_emit(c, call);
+    lcomp_emit(c, x->count);
+    lcomp_push(c, 1 - x->count);
+}
 
-    /* single expression */
-    if (v->count == 1) { return lval_take(v, 0); }
+/* compile body (a Q-expression) for a lambda taking formals */
+lcode* lcode_compile(lval* formals, lval* body) {
+    lcomp c = { NULL, 0, 0, NULL, 0, 0 };
+    c.code = calloc(1, sizeof(lcode));
+    c.code->formals = lval_ref(formals);
+
+    /* one slot per formal, in binding order; & itself doesn't get one */
+    c.slots = malloc(sizeof(latom*) * (formals->count + 1));
+    for (int i = 0; i < formals->count; i++) {
+        latom* sym = formals->cell[i]->sym;
+        if (sym == latom_amp) {
+            /* lval_bind will complain at call time; leave it to it */
+            if (i != formals->count - 2) { c.failed = 1; }
+            continue;
+        }
+        /* a repeated name shares one binding, which breaks slot order */
+        for (int j = 0; j < c.nslots; j++) {
+            if (c.slots[j] == sym) { c.failed = 1; }
+        }
+        c.slots[c.nslots++] = sym;
+    }
 
-    /* ensure out first element is a symbol */
-    lval* f = lval_pop(v, 0);
-    if (f->type != LVAL_FUN) {
-        lval_del(f); lval_del(v);
-        return lval_err("First element is not a function");
+    /* the body is evaluated as an sexpr, in tail position */
+    if (!c.failed) {
+        lval sexpr = *body;
+        sexpr.type = LVAL_SEXPR;
+        lcomp_sexpr(&c, &sexpr, 1);
     }
 
-    /* call builtin with operator */
-    lval* result = lval_call(e, f, v);
-    lval_del(f);
-    return result;
+    free(c.slots);
+    if (c.failed) {
+        for (int i = 0; i < c.code->nconsts; i++) {
+            lval_del(c.code->consts[i]);
+        }
+        free(c.code->consts);
+        free(c.code->ops);
+        c.code->nconsts = c.code->count = 0;
+        c.code->consts = NULL;
+        c.code->ops = NULL;
+    }
+    return c.code;
 }
 
-/* already declared */
-lval* lval_eval(lenv* e, lval* v) {
-    /* look up sym in environment */
-    if (v->type == LVAL_SYM) {
-        lval* x = lenv_get(e, v);
-        lval_del(v);
-        return x;
+/* make sure the user function f's body has bytecode for f's formals.
+ * code lives on the body so that copies of f, which share it, share
+ * the code too; a body shared with some other lambda's formals is
+ * split off first. a partial's frame starts with the arguments it was
+ * already given (see lval_bind), so its slots have to as well */
+void lcode_for(lval* f) {
+    lval* formals = f->formals;
+    if (f->env->count) {
+        formals = lval_qexpr();
+        for (int i = 0; i < f->env->count; i++) {
+            lval* k = lval_alloc(LVAL_SYM);
+            k->sym = f->env->syms[i];
+            formals = lval_add(formals, k);
+        }
+        for (int i = 0; i < f->formals->count; i++) {
+            formals = lval_add(formals, lval_ref(f->formals->cell[i]));
+        }
+    }
+
+    lval* body = f->body;
+    if (body->code && !lval_eq(body->code->formals, formals)) {
+        f->body = lval_copy(body);
+        lval_del(body);
+        body = f->body;
+    }
+    if (!body->code) { body->code = lcode_compile(formals, body); }
+    if (formals != f->formals) { lval_del(formals); }
+}
+
+lval* lval_apply(lenv* e, lval* v);
+
+/* a compiled lambda that a body called, and what to carry on with once
+ * it returns */
+typedef struct lvm_call {
+    lcode* code;
+    int pc;
+    lenv* env;
+    /* the function running, and the first of the frames its tail calls
+     * have made, on envs */
+    lval* f;
+    int frames;
+    /* the profile node it was called from */
+    lprof* caller;
+} lvm_call;
+
+/* each thread's VM: the value stack, the calls in progress, and the
+ * frames they run in, all of which grow as needed */
+typedef struct lvm_state {
+    lval** stack;
+    int sp;
+    int cap;
+    lvm_call* calls;
+    int ncalls;
+    int callcap;
+    lenv** envs;
+    int nenvs;
+    int envcap;
+} lvm_state;
+
+__thread lvm_state lvm;
+
+/* make room for n more values on the stack, which may move it */
+void lvm_reserve(lvm_state* m, int n) {
+    if (m->sp + n <= m->cap) { return; }
+    while (m->sp + n > m->cap) { m->cap = m->cap ? m->cap * 2 : 256; }
+    m->stack = realloc(m->stack, sizeof(lval*) * m->cap);
+}
+
+void lvm_cleanup(void) {
+    free(lvm.stack);
+    free(lvm.calls);
+    free(lvm.envs);
+    memset(&lvm, 0, sizeof(lvm_state));
+}
+
+/* take the top n values off the stack as an sexpr */
+lval* lvm_list(lval** stack, int* sp, int n) {
+    lval* v = lval_sexpr();
+    v->cells = lcells_new(n);
+    v->cells->hi = n;
+    v->count = n;
+    v->cell = v->cells->items;
+    *sp -= n;
+    memcpy(v->cell, &stack[*sp], sizeof(lval*) * n);
+    return v;
+}
+
+/* if v is a call with no errors in it to a lambda that compiles, pop the
+ * lambda off v and return it; otherwise NULL, for lval_apply to deal
+ * with v as usual */
+lval* lvm_callee(lval* v) {
+    if (!v->count) { return NULL; }
+    lval* f = v->cell[0];
+    if (f->type != LVAL_FUN || f->builtin) { return NULL; }
+    for (int i = 1; i < v->count; i++) {
+        if (v->cell[i]->type == LVAL_ERR) { return NULL; }
+    }
+    if (!f->body->code) { lcode_for(f); }
+    if (!f->body->code->ops) { return NULL; }
+    return lval_pop(v, 0);
+}
+
+/* run c in e, the env of the call it was compiled for. its final call
+ * comes back for lval_eval to carry out, but any it makes on the way
+ * to a compiled lambda is run here; see lvm_call */
+lval* lvm_run(lenv* e, lcode* c) {
+    lvm_state* m = &lvm;
+    int bottom = m->ncalls;
+    lvm_reserve(m, c->depth);
+    lval** stack = m->stack;
+    int sp = m->sp;
+    int* ops = c->ops;
+    int pc = 0;
+
+    while (1) {
+        lval* r = NULL;
+        switch (ops[pc++]) {
+            case LOP_CONST:
+                stack[sp++] = lval_ref(c->consts[ops[pc++]]);
+            continue;
+            case LOP_LOCAL:
+                stack[sp++] = lval_ref(e->vals[ops[pc++]]);
+            continue;
+            case LOP_NAME:
+                stack[sp++] = lenv_get(e, c->consts[ops[pc++]]);
+            continue;
+            case LOP_IF: {
+                lval* f = stack[sp-2];
+                lval* cond = stack[sp-1];
+                if (f->type == LVAL_FUN && f->builtin == builtin_if &&
+                    cond->type == LVAL_NUM) {
+                    pc = cond->num ? pc + 2 : ops[pc];
+                    lval_del(f); lval_del(cond);
+                    sp -= 2;
+                } else {
+                    pc = ops[pc+1];
+                }
+            }
+            continue;
+            case LOP_JUMP:
+                pc = ops[pc];
+            continue;
+
+            case LOP_CALL:
+            case LOP_TAILCALL: {
+                int tail = ops[pc-1] == LOP_TAILCALL;
+                lval* v = lvm_list(stack, &sp, ops[pc++]);
+                m->sp = sp;
+                /* the body we were started on is done */
+                if (tail && m->ncalls == bottom) { return v; }
+
+                lval* f = lvm_callee(v);
+                if (!f) {
+                    r = lval_apply(e, v);
+                    stack = m->stack;
+                    if (!tail) {
+                        stack[sp++] = r;
+                        continue;
+                    }
+                    break;
+                }
+
+                lcount.lambda_calls++;
+                lenv* n;
+                r = lval_bind(f, v, &n);
+                if (r) {
+                    lval_del(f);
+                    if (!tail) {
+                        stack[sp++] = r;
+                        continue;
+                    }
+                    break;
+                }
+
+                /* the frames nest as lval_eval's do, and a tail call lets
+                 * go of one it shadows */
+                n->par = e;
+                lvm_call* k;
+                if (tail) {
+                    k = &m->calls[m->ncalls-1];
+                    if (lenv_shadows(n, e)) {
+                        n->par = e->par;
+                        lenv_del(m->envs[--m->nenvs]);
+                    }
+                    lval_del(k->f);
+                    k->f = f;
+                } else {
+                    if (m->ncalls == m->callcap) {
+                        m->callcap = m->callcap ? m->callcap * 2 : 64;
+                        m->calls = realloc(m->calls, sizeof(lvm_call) * m->callcap);
+                    }
+                    k = &m->calls[m->ncalls++];
+                    k->code = c;
+                    k->pc = pc;
+                    k->env = e;
+                    k->f = f;
+                    k->frames = m->nenvs;
+                    k->caller = lprof_at;
+                    lcount.evals++;
+                }
+                if (m->nenvs == m->envcap) {
+                    m->envcap = m->envcap ? m->envcap * 2 : 64;
+                    m->envs = realloc(m->envs, sizeof(lenv*) * m->envcap);
+                }
+                m->envs[m->nenvs++] = n;
+                if (k->caller) { lprof_call(k->caller, f->env->name, NULL); }
+
+                e = n;
+                c = f->body->code;
+                ops = c->ops;
+                pc = 0;
+                lvm_reserve(m, c->depth);
+                stack = m->stack;
+            }
+            continue;
+        }
+
+        /* the call on top has come to r: back to where it was made */
+        lvm_call* k = &m->calls[--m->ncalls];
+        while (m->nenvs > k->frames) { lenv_del(m->envs[--m->nenvs]); }
+        lval_del(k->f);
+        if (k->caller) { lprof_return(k->caller); }
+        c = k->code;
+        ops = c->ops;
+        pc = k->pc;
+        e = k->env;
+        stack[sp++] = r;
     }
+}
+
+/* already declared
+ *
+ * anything in tail position (the branch an if picks, what eval is given,
+ * the body of a lambda) is evaluated by going round this loop again
+ * rather than recursing, so tail calls run in constant C stack */
+lval* lval_eval_loop(lenv* e, lval* v, int evaluated) {
+    /* the frames of the lambdas we've tail called into; we run in the last.
+     * most evaluations never get that far, so it's made on demand */
+    lenv** frames = NULL;
+    int nframes = 0;
+    int fcap = 0;
+
+    /* while profiling, the call path we were evaluated on. a lambda this
+     * loop calls (or tail calls) is entered from there, see lprof_call */
+    lprof* caller = lprof_at;
+    int entered = 0;
+
+    lcount.evals++;
+    while (1) {
+        /* v is either an expression, or (from the bytecode) a call whose
+         * children have already been evaluated */
+        if (!evaluated) {
+            /* look up sym in environment */
+            if (v->type == LVAL_SYM) {
+                lval* x = lenv_get(e, v);
+                lval_del(v);
+                v = x;
+                break;
+            }
+
+            /* anything but an sexpr is just itself */
+            if (v->type != LVAL_SEXPR) { break; }
+
+            /* the children get replaced with their values, so v (and
+             * its storage) must be ours */
+            v = lval_own(v);
+            lval_unshare(v);
+
+            /* eval the children first */
+            for (int i = 0; i < v->count; i++) {
+                v->cell[i] = lval_eval(e, v->cell[i]);
+            }
+        }
+        evaluated = 0;
+
+        /* error checking */
+        int err = -1;
+        for (int i = 0; i < v->count && err < 0; i++) {
+            if (v->cell[i]->type == LVAL_ERR) { err = i; }
+        }
+        if (err >= 0) { v = lval_take(v, err); break; }
+
+        /* empty expr */
+        if (v->count == 0) { break; }
+
+        /* single expression; a lone function is called with no arguments */
+        if (v->count == 1 && v->cell[0]->type != LVAL_FUN) {
+            v = lval_take(v, 0);
+            break;
+        }
+
+        /* ensure out first element is a function */
+        lval* f = lval_pop(v, 0);
+        if (f->type != LVAL_FUN) {
+            lval_del(f); lval_del(v);
+            v = lval_err("First element is not a function");
+            break;
+        }
+        if (f->builtin) {
+            lcount.builtin_calls++;
+        } else {
+            lcount.lambda_calls++;
+        }
 
-    /* evaluate sexpr */
-    if (v->type == LVAL_SEXPR) {
-        return lval_eval_sexpr(e, v);
+        /* if and eval end by evaluating something in this env: go round */
+        if (f->builtin == builtin_if || f->builtin == builtin_eval) {
+            v = f->builtin == builtin_if ? builtin_if_tail(v) : builtin_eval_tail(v);
+            lval_del(f);
+            if (v->type == LVAL_ERR) { break; }
+            continue;
+        }
+
+        /* any other builtin just does its thing */
+        if (f->builtin) {
+            lprof* at = lprof_at;
+            if (at) { lprof_call(at, NULL, f->builtin); }
+            v = f->builtin(e, v);
+            if (at) { lprof_return(at); }
+            lval_del(f);
+            break;
+        }
+
+        /* bind the arguments into a new frame, leaving f alone */
+        lenv* n;
+        lval* x = lval_bind(f, v, &n);
+        if (x) {
+            lval_del(f);
+            v = x;
+            break;
+        }
+
+        /* the body runs in that frame, which is nested in ours as usual.
+         * if ours came from an earlier tail call and f rebinds all of
+         * its names (say, a function looping on itself) it can never be
+         * seen again, so let it go rather than pile up frames */
+        n->par = e;
+        if (nframes && lenv_shadows(n, e)) {
+            n->par = e->par;
+            lenv_del(frames[--nframes]);
+        } else if (nframes == fcap) {
+            fcap = fcap ? fcap * 2 : 8;
+            frames = realloc(frames, sizeof(lenv*) * fcap);
+        }
+        frames[nframes++] = n;
+        e = n;
+
+        if (caller) {
+            lprof_call(caller, f->env->name, NULL);
+            entered = 1;
+        }
+
+        /* functions from an image are only compiled once they're used */
+        if (lvm_enabled && !f->body->code) { lcode_for(f); }
+
+        /* run the compiled body as far as its final call */
+        lcode* code = f->body->code;
+        if (lvm_enabled && code && code->ops) {
+            v = lvm_run(e, code);
+            lval_del(f);
+            evaluated = 1;
+            continue;
+        }
+
+        v = lval_own(lval_ref(f->body));
+        v->type = LVAL_SEXPR;
+        lval_del(f);
     }
 
-    /* else just return yourself */
+    while (nframes) { lenv_del(frames[--nframes]); }
+    free(frames);
+    if (entered) { lprof_return(caller); }
     return v;
 }
 
+lval* lval_eval(lenv* e, lval* v) {
+    return lval_eval_loop(e, v, 0);
+}
+
+/* carry out v, an sexpr whose children are already values */
+lval* lval_apply(lenv* e, lval* v) {
+    return lval_eval_loop(e, v, 1);
+}
 
 lval* lval_read_num(mpc_ast_t* t) {
+    errno = 0;
+
+    /* a point or an exponent makes it a double */
+    if (strpbrk(t->contents, ".eE")) {
+        double x = strtod(t->contents, NULL);
+        return errno != ERANGE ? lval_dbl(x) : lval_err("invalid number");
+    }
+
+    /* and too many digits for a long makes it a bignum */
     long x = strtol(t->contents, NULL, 10);
-    return errno != ERANGE ? lval_num(x) : lval_err("invalid number");
+    return errno != ERANGE ? lval_num(x) : lval_big(lbig_read(t->contents));
 }
 
 lval* lval_read_string(mpc_ast_t* t) {
@@ -1050,80 +5793,168 @@ lval* lval_read(mpc_ast_t* t) {
     return x;
 }
 
-int main(int argc, char** argv) {
-    /* create some parsers */
-    Number  = mpc_new("number");
-    Symbol  = mpc_new("symbol");
-    Sexpr   = mpc_new("sexpr");
-    String  = mpc_new("string");
-    Comment = mpc_new("comment");
-    Qexpr   = mpc_new("qexpr");
-    Expr    = mpc_new("expr");
+/* for a flag given without the argument it takes */
+int lmain_usage(char* flag) {
+    fprintf(stderr, "Usage: %s needs an argument\n", flag);
+    return 1;
+}
 
-    /* Define them with this language */
-    mpca_lang(MPC_LANG_DEFAULT,
-    "   number  : /-?[0-9]+/ ;                          \
-        symbol  : /[a-zA-Z0-9_+\\-*\\/\\\\=<>!&\\.]+/ ; \
-        sexpr   : '(' <expr>* ')' | <number> ;          \
-        qexpr   : '{' <expr>* '}' ;                     \
-        string  : /\"(\\\\.|[^\"])*\"/ ;                \
-        comment : /;[^\\r\\n]*/ ;                       \
-        expr    : <number> | <symbol>  | <sexpr>        \
-                | <qexpr>  | <comment> | <string>       \
-                | /^/ <expr>* /$/ ;                     ",
-    Number, Symbol, Sexpr, Qexpr, String, Comment, Expr);
+int main(int argc, char** argv) {
+    latom_amp = latom_intern("&");
+    latom_if = latom_intern("if");
+    lval_small_init();
 
     lenv* e = lenv_new();
+    lenv_root = e;
     lenv_add_builtins(e);
 
-    if (argc == 1) {
+    /* pull out our flags, shuffling the filenames down to argv[1..files] */
+    int files = 0;
+    char* image_in = NULL;
+    char* image_out = NULL;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--gc") == 0) {
+            gc_enabled = 1;
+        } else if (strcmp(argv[i], "--gc-stats") == 0) {
+            gc_enabled = gc_stats = 1;
+        } else if (strcmp(argv[i], "--stats") == 0) {
+            lstats_exit = 1;
+        } else if (strcmp(argv[i], "--no-vm") == 0) {
+            lvm_enabled = 0;
+        } else if (strcmp(argv[i], "--flat-lists") == 0) {
+            lcells_shared = 0;
+        } else if (strcmp(argv[i], "--workers") == 0) {
+            if (i+1 == argc) { return lmain_usage(argv[i]); }
+            lpar_workers = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--time") == 0) {
+            lrun_timing = 1;
+        } else if (strcmp(argv[i], "--profile") == 0) {
+            lprof_exit = 1;
+        } else if (strcmp(argv[i], "--profile-folded") == 0) {
+            if (i+1 == argc) { return lmain_usage(argv[i]); }
+            lprof_folded = argv[++i];
+        } else if (strcmp(argv[i], "--mpc-reader") == 0) {
+            lreader_mpc = 1;
+        } else if (strcmp(argv[i], "--load-image") == 0) {
+            if (i+1 == argc) { return lmain_usage(argv[i]); }
+            image_in = argv[++i];
+        } else if (strcmp(argv[i], "--dump-image") == 0) {
+            if (i+1 == argc) { return lmain_usage(argv[i]); }
+            image_out = argv[++i];
+        } else {
+            argv[++files] = argv[i];
+        }
+    }
+
+    if (lreader_mpc) { lreader_mpc_init(); }
+
+    /* an image stands in for loading whatever it was dumped after */
+    if (image_in) {
+        lval* err = limage_load(e, image_in);
+        if (err) {
+            lval_println(err);
+            lval_del(err);
+            return 1;
+        }
+    }
+
+    if (lprof_exit || lprof_folded) { lprof_start(); }
+
+    if (files == 0) {
         /* Print Exit Instructions */
         puts("Press Ctrl+c to Exit");
 
         while(1) {
 
             char* input = readline("lispy> ");
+            /* Ctrl+d */
+            if (!input) { putchar('\n'); break; }
             add_history(input);
 
-            mpc_result_t r;
-            if (mpc_parse("<stdin>", input, Expr, &r)) {
-                lval* x = lval_eval(e, lval_read(r.output));
-                lval_println(x);
-                lval_del(x);
-                mpc_ast_delete(r.output);
-            } else {
-                /* otherwise print error */
-                mpc_err_print(r.error);
-                mpc_err_delete(r.error);
+            /* print what each form on the line comes to */
+            lreader r;
+            lreader_string(&r, "<stdin>", input);
+            lval* x;
+            while ((x = lreader_next(&r))) {
+                lval* v = lval_eval(e, x);
+                lval_println(v);
+                lval_del(v);
             }
+            lreader_close(&r);
 
             /* Free retrived input */
             free(input);
+
+            gc_maybe_collect(e, NULL);
         }
     }
 
-    if (argc >= 2) {
-        /* loop through supplied filenames */
-        for (int i = 1; i < argc; ++i) {
+    /* otherwise run each file ("-" being stdin) start to finish, printing
+     * only errors, and exit with 1 if there were any */
+    int failed = 0;
+    long forms_total = 0;
+    double parse_total = 0;
+    double eval_total = 0;
+
+    for (int i = 1; i <= files; ++i) {
+        lreader r;
+        lval* err = lreader_open(&r, argv[i]);
+        if (err) {
+            lval_println(err);
+            lval_del(err);
+            failed = 1;
+            continue;
+        }
 
-            /* build lval with filename */
-            lval* args = lval_add(lval_sexpr(), lval_str(argv[i]));
+        if (lval_run(e, &r, 1)) { failed = 1; }
+        double eval = lreader_eval_time(&r);
+        if (lrun_timing) { lrun_report(r.name, r.count, r.time, eval); }
+        forms_total += r.count;
+        parse_total += r.time;
+        eval_total += eval;
+        lreader_close(&r);
+    }
 
-            /* load the file */
-            lval* x = builtin_load(e, args);
+    if (lrun_timing && files > 1) {
+        lrun_report("total", forms_total, parse_total, eval_total);
+    }
 
-            /* output error */
-            if (x->type == LVAL_ERR) {
-                lval_println(x);
-            }
+    if (image_out) {
+        lval* err = limage_dump(e, image_out);
+        if (err) {
+            lval_println(err);
+            lval_del(err);
+            failed = 1;
+        }
+    }
 
-            /* cleanup */
-            lval_del(x);
+    if (gc_stats) { gc_print_stats(); }
+    if (lstats_exit) { lstats_print(); }
+
+    if (lprof_exit || lprof_folded) {
+        lprof_stop();
+        if (lprof_exit) { lprof_print(); }
+        lval* err = lprof_folded ? lprof_write(lprof_folded) : NULL;
+        if (err) {
+            lval_println(err);
+            lval_del(err);
+            failed = 1;
         }
     }
+    lprof_free(&lprof_root);
 
+    /* futures let go of their results before the workers go */
     lenv_del(e);
-
-    mpc_cleanup(7, Number, Symbol, Sexpr, Qexpr, Comment, Expr, String);
-    return 0;
+    lpar_cleanup();
+    lvm_cleanup();
+    latom_cleanup();
+    lpool_cleanup(&lval_pool);
+    lpool_cleanup(&lenv_pool);
+
+    if (lreader_mpc) {
+        mpc_cleanup(8, Number, Symbol, Sexpr, Qexpr, Comment, Expr, String, Program);
+    }
+    free(lbuiltin_names);
+    free(lbuiltin_funcs);
+    return failed;
 }
\ No newline at end of file
@@ -0,0 +1,38 @@
+#!/bin/sh
+# --dump-image a prelude, then --load-image it in a second run instead of
+# loading the prelude again. run it from the top of the tree:
+# sh tests/image.sh [repl]
+
+repl=${1:-./repl}
+tmp=${TMPDIR:-/tmp}/lispy-test.$$
+mkdir -p "$tmp" || exit 1
+trap 'rm -rf "$tmp"' EXIT
+
+cat > "$tmp/prelude.lspy" <<EOF
+(def {add} (\ {a b} {+ a b}))
+(def {inc} (add 1))
+(def {sq} (\ {x} {* x x}))
+(def {big} (* 123456789012345678901234567890 10))
+(def {v} (vec {1 2 3}))
+(def {tree} {1 {2 {3 {sym "str"}}} {}})
+EOF
+"$repl" "$tmp/prelude.lspy" --dump-image "$tmp/prelude.img"
+echo "dump: $?"
+
+"$repl" --load-image "$tmp/prelude.img" - <<EOF
+(print (add 2 3) (inc 41) (sq 12))
+(print inc)
+(print big (+ big 1))
+(print v (vsum v))
+(print tree (head (tail tree)))
+EOF
+echo "load: $?"
+
+# an image cut short, and one nested too deep to be anything but corrupt
+head -c 40 "$tmp/prelude.img" > "$tmp/truncated.img"
+"$repl" --load-image "$tmp/truncated.img" - < /dev/null
+echo "truncated: $?"
+awk 'BEGIN { printf "lispyimg\002\001\003x"; for (i = 0; i < 20000; i++) printf "\007\001" }' \
+    > "$tmp/deep.img"
+"$repl" --load-image "$tmp/deep.img" - < /dev/null
+echo "deep: $?"
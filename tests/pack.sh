@@ -0,0 +1,44 @@
+#!/bin/sh
+# serialize and deserialize, writing to a directory of this run's own.
+# run it from the top of the tree: sh tests/pack.sh [repl]
+
+repl=${1:-./repl}
+tmp=${TMPDIR:-/tmp}/lispy-test.$$
+mkdir -p "$tmp" || exit 1
+trap 'rm -rf "$tmp"' EXIT
+
+"$repl" - <<EOF
+; every type that can be packed comes back as it went in. (errors can't
+; be held in a value, so can't be packed)
+(def {roundtrip} (\ {x} {(\ {n} {deserialize "$tmp/pack.bin"}) (serialize "$tmp/pack.bin" x)}))
+(def {check} (\ {x} {print (roundtrip x) (== x (roundtrip x))}))
+(check 42)
+(check -9223372036854775807)
+(check 0.1)
+(check -0.0)
+(check 2.5e-7)
+(check 1e300)
+(check (/ 1 3.0))
+(check 123456789012345678901234567890)
+(check -98765432109876543210)
+(check "a string")
+(check "")
+(check {sym (sexpr 1 2) {nested "str" "str"} {}})
+(check (list "same" "same" "other" "same"))
+(check head)
+(check (\ {x y} {+ x y}))
+(check ((\ {x y} {+ x y}) 10))
+(check (vec {1 -2 3}))
+(check (vec {1.5 -2.25}))
+(print ((roundtrip (\ {x} {* x x})) 12) ((roundtrip ((\ {x y} {+ x y}) 10)) 5))
+; what can't be packed, and files that aren't (or aren't all) packed values
+(serialize "$tmp/pack.bin" (spawn {1}))
+(deserialize "tests/pack.sh")
+(deserialize "tests/pack/missing.bin")
+(deserialize "tests/pack/truncated.bin")
+(deserialize "tests/pack/biglimb.bin")
+(deserialize "tests/pack/badtag.bin")
+(deserialize "tests/pack/deep.bin")
+(deserialize "tests/pack/trailing.bin")
+(deserialize "tests/pack/version1.bin")
+EOF
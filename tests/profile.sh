@@ -0,0 +1,50 @@
+#!/bin/sh
+# the profiler's call counts and call paths, which (unlike its times)
+# don't change from run to run. run it from the top of the tree:
+# sh tests/profile.sh [repl]
+
+repl=${1:-./repl}
+# so sort puts names in the same order everywhere
+LC_ALL=C
+export LC_ALL
+tmp=${TMPDIR:-/tmp}/lispy-test.$$
+mkdir -p "$tmp" || exit 1
+trap 'rm -rf "$tmp"' EXIT
+
+cat > "$tmp/fib.lspy" <<EOF
+(def {fib} (\ {n} {if (< n 2) {n} {+ (fib (- n 1)) (fib (- n 2))}}))
+(fib 4)
+EOF
+
+# the folded stacks, less their times
+echo "== --profile-folded"
+"$repl" --profile-folded "$tmp/fib.folded" "$tmp/fib.lspy"
+sed 's/ [0-9]*$//' "$tmp/fib.folded"
+
+# the report goes to stderr; keep the calls and names, in name order
+echo "== --profile"
+"$repl" --profile "$tmp/fib.lspy" 2>&1 >/dev/null | awk 'NR > 2 { print $6, $5 }' | sort
+
+# a lambda is known by the first name it's given, even when another name
+# is given to a copy of it that it shares storage with
+echo "== naming"
+"$repl" - 2>&1 >/dev/null <<EOF | awk 'NR > 2 { print $6, $5 }' | sort
+(def {fs} (list (\ {x} {+ x 1})))
+(def {g} (eval (head fs)))
+(def {h} (eval (head fs)))
+(profile-start)
+(g 1) (h 2) (g 3)
+(def {f} g)
+(f 4)
+(profile-report)
+EOF
+
+echo "== profile-report to a file"
+"$repl" - <<EOF
+(profile-start)
+(def {sq} (\ {x} {* x x}))
+(sq 3)
+(profile-report "$tmp/sq.folded")
+(profile-report 1)
+EOF
+sed 's/ [0-9]*$//' "$tmp/sq.folded"
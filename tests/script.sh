@@ -0,0 +1,36 @@
+#!/bin/sh
+# script mode: every form in every file (and stdin, as -) is run in
+# turn, with only errors shown, and the exit status says if there were
+# any. run it from the top of the tree: sh tests/script.sh [repl]
+
+repl=${1:-./repl}
+tmp=${TMPDIR:-/tmp}/lispy-test.$$
+mkdir -p "$tmp" || exit 1
+trap 'rm -rf "$tmp"' EXIT
+
+cat > "$tmp/a.lspy" <<EOF
+(def {x} 1) (print "a" x)
+(+ 1 2)
+(print "a again")
+EOF
+cat > "$tmp/b.lspy" <<EOF
+(print "b" (+ x 1))
+(undefined 1)
+(print "b after an error")
+(head {})
+(print "b at the end")
+EOF
+
+echo "== files, then stdin between them"
+echo '(print "stdin" x) (def {y} 5)' |
+    "$repl" "$tmp/a.lspy" - "$tmp/b.lspy"
+echo "status: $?"
+
+echo "== no errors"
+echo '(print (+ 1 2))' | "$repl" "$tmp/a.lspy" -
+echo "status: $?"
+
+echo "== a file that can't be opened doesn't stop the rest"
+"$repl" "$tmp/missing.lspy" "$tmp/a.lspy" < /dev/null > "$tmp/out"
+echo "status: $?"
+sed "s|$tmp/||" "$tmp/out"